@@ -0,0 +1,86 @@
+#ifndef COALESCENCE_ASYNC_WRITER_H
+#define COALESCENCE_ASYNC_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "coalescence/nuclei_output.h"
+#include "coalescence/particle.h"
+
+namespace coalescence {
+
+/**
+ * Writes nuclei with a NucleiWriter on a separate thread, so that
+ * formatting, compression and disk access do not hold up the coalescence.
+ *
+ * Events are passed through a bounded single-producer single-consumer
+ * ring of slots, synchronized by the two atomic counters. Nuclei buffers
+ * are swapped in and out of the slots, so their memory is reused. A side,
+ * which can't go on, because the ring is full or empty, sleeps on a
+ * condition variable until the other side moved its counter, instead of
+ * polling.
+ */
+class AsyncNucleiWriter {
+ public:
+  AsyncNucleiWriter(std::unique_ptr<NucleiWriter> writer, size_t capacity);
+  /// Writes all queued events before returning
+  ~AsyncNucleiWriter();
+  AsyncNucleiWriter(const AsyncNucleiWriter &) = delete;
+  AsyncNucleiWriter &operator=(const AsyncNucleiWriter &) = delete;
+
+  /**
+   * Queue the nuclei of an event for writing. \p nuclei is exchanged with
+   * an empty buffer of a previously written event.
+   */
+  void write_event(size_t event_number, std::vector<Particle> &nuclei);
+
+  /// Wait until all queued events are written
+  void flush();
+
+  /**
+   * Reserve memory for \p n_nuclei in the buffers of the free slots,
+   * which are exchanged for the nuclei of the next events
+   */
+  void reserve(size_t n_nuclei);
+
+  /// The underlying writer, only to be used after flush()
+  NucleiWriter &writer() { return *writer_; }
+
+ private:
+  struct Slot {
+    size_t event_number;
+    std::vector<Particle> nuclei;
+  };
+
+  /// Main loop of the writer thread
+  void run();
+  /// Rethrow an exception from the writer thread in the caller
+  void check_error();
+  /// Wake up the other side waiting on \p condition for a new counter
+  void notify(std::condition_variable &condition);
+
+  std::unique_ptr<NucleiWriter> writer_;
+  std::vector<Slot> slots_;
+  // Number of events queued and written so far, the slot of an event is
+  // its number modulo the capacity
+  std::atomic<size_t> n_queued_;
+  std::atomic<size_t> n_written_;
+  std::atomic<bool> stop_;
+  // The writer thread waits for queued events, the producer for written
+  // ones. A counter is changed before the mutex is taken for notifying,
+  // so that no wake-up is lost between checking a counter and waiting.
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable written_;
+  std::atomic<bool> failed_;
+  std::exception_ptr error_;
+  std::thread thread_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_ASYNC_WRITER_H
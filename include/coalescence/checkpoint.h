@@ -0,0 +1,46 @@
+#ifndef COALESCENCE_CHECKPOINT_H
+#define COALESCENCE_CHECKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "coalescence/histograms.h"
+
+namespace coalescence {
+
+/**
+ * State of a run over several input files after a number of events, from
+ * which an interrupted run can be continued with the same results. The
+ * random numbers of a pair only depend on the seed and the position of
+ * the event, so there is no generator state to keep.
+ *
+ * The binary file consists of
+ *   "CKPT", uint16 version, uint64 seed, uint64 event number,
+ *   uint64 file index, uint64 events done in the file,
+ *   uint64 output size,
+ * followed by the histograms as written by HistogramSet::write_state.
+ */
+struct Checkpoint {
+  uint64_t seed = 0;
+  // Number of the next event
+  uint64_t event_number = 0;
+  // Input file to continue with and the events of it already coalesced
+  uint64_t file_index = 0;
+  uint64_t events_done = 0;
+  // Bytes of the output written up to this point
+  uint64_t output_size = 0;
+  HistogramSet histograms;
+
+  /**
+   * Write the checkpoint to a temporary file, which then replaces \p file,
+   * so that an interruption leaves the previous checkpoint intact. Throws
+   * std::runtime_error if it can't be written.
+   */
+  void write(const std::string &file) const;
+  /// Checkpoint in \p file, throws std::runtime_error if it is not one
+  static Checkpoint read(const std::string &file);
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_CHECKPOINT_H
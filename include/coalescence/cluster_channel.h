@@ -0,0 +1,52 @@
+#ifndef COALESCENCE_CLUSTER_CHANNEL_H
+#define COALESCENCE_CLUSTER_CHANNEL_H
+
+#include <cstddef>
+
+#include "coalescence/particle.h"
+
+namespace coalescence {
+
+/// Cut deciding, whether a pair of particles forms a cluster
+enum class CutType {
+  sharp,   // box in momentum and distance, accepted with the spin factor
+  wigner,  // Gaussian Wigner function, every pair is weighted
+};
+
+/**
+ * Compile-time description of the coalescence of two particles a + b
+ * into a cluster. The spin and isospin factor Num / Den is the
+ * probability to form the cluster if the pair is close enough. Kernels
+ * instantiated for a channel see all of it as constants.
+ */
+template <ParticleType A, ParticleType B, ParticleType Product,
+          int Num, int Den>
+struct ClusterChannel {
+  static_assert(0 < Num && Num <= Den,
+                "The spin and isospin factor is a probability");
+  static constexpr ParticleType a = A;
+  static constexpr ParticleType b = B;
+  static constexpr ParticleType product = Product;
+  static constexpr double probability = static_cast<double>(Num) / Den;
+  /// Pairs of the same type are taken once
+  static constexpr bool same_type = A == B;
+};
+
+/// Channels in the order they are tried
+template <typename... Channels>
+struct ChannelList {
+  static constexpr size_t size = sizeof...(Channels);
+};
+
+/// Call \p f.template apply<Channel>(index) for the channels in order
+template <size_t Index, typename F>
+inline void for_each_channel(ChannelList<>, F &) {}
+
+template <size_t Index = 0, typename F, typename First, typename... Rest>
+inline void for_each_channel(ChannelList<First, Rest...>, F &f) {
+  f.template apply<First>(Index);
+  for_each_channel<Index + 1>(ChannelList<Rest...>(), f);
+}
+
+}  // namespace coalescence
+#endif  // COALESCENCE_CLUSTER_CHANNEL_H
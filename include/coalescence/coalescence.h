@@ -1,79 +1,277 @@
 #ifndef COALESCENCE_H
 #define COALESCENCE_H
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
-#include <random>
 
+#include "coalescence/async_writer.h"
+#include "coalescence/checkpoint.h"
+#include "coalescence/cluster_channel.h"
 #include "coalescence/fourvector.h"
+#include "coalescence/histograms.h"
+#include "coalescence/momentum_grid.h"
+#include "coalescence/nuclei_output.h"
+#include "coalescence/pair_random.h"
+#include "coalescence/pair_search.h"
+#include "coalescence/pair_weight_kernel.h"
+#include "coalescence/particle.h"
 
 namespace coalescence {
 
-enum class ParticleType : char {
-  boring, // hadrons not interesting for coalescence
-  p,    // proton
-  n,    // neutron
-  la,   // lambda
-  sig0, // Sigma0
-  ap,   // anti-proton
-  an,   // anti-neuton
-  ala,  // anti-lambda
-  asig0, // anti-Sigma0
-  d,     // deuteron
-  t,     // triton
-  He3,   // Helium-3
-  H3L,   // Hypertriton
-  He4_0, // Helium-4 ground state
-  // ...
-};
-
-struct Particle {
-  FourVector momentum;  // 4-momentum
-  FourVector origin;    // 4-position of origin
-  ParticleType type;
-  int32_t pdg_mother1;
-  int32_t pdg_mother2;
-  double weight;
-  bool valid;
-};
-
 class Coalescence {
  public:
+  /**
+   * Working memory of the coalescence of one event. It is kept between
+   * events, so that buffers are allocated only until they reach the
+   * size needed by the largest event.
+   */
+  struct EventArena {
+    // Particles of each type in the cluster channels and partner finders
+    // over them
+    std::array<std::vector<Particle>, n_particle_types> clusters;
+    std::array<PairFinder, n_particle_types> cluster_finders;
+    std::vector<Particle> nucleons;
+    MomentumGrid grid;
+    std::vector<size_t> candidates;
+    std::vector<uint32_t> positions;
+    std::vector<double> weights;
+    // Events coalesced with this arena and how many of them needed more
+    // memory than the events before, in the arena or in any other buffer
+    // of the event: its hadrons, its nuclei and its mixing slot
+    size_t n_events = 0;
+    size_t n_grown = 0;
+    /// Bytes of memory reserved by all buffers
+    size_t memory_size() const;
+    /// Reserve in each buffer \p factor times the memory reserved by \p other
+    void reserve_like(const EventArena &other, double factor = 1.0);
+  };
+
+  /**
+   * With a \p resume_output_size the output of an interrupted run is
+   * continued from the size it had at its checkpoint, see restore().
+   */
   Coalescence(const std::string output_file,
               double deuteron_deltap, double deuteron_deltar,
-              bool probabilistic);
+              bool probabilistic, uint64_t seed,
+              OutputFormat output_format, bool compress_output,
+              uint64_t resume_output_size = 0);
   ~Coalescence();
   static FourVector combined_r(const Particle &h1, const Particle &h2);
-  bool check_vicinity(const Particle &h1, const Particle &h2, double deltap, double deltar);
+  /// Squared momentum difference of a pair in its center of mass frame
+  static double cm_momentum_difference_sqr(const FourVector &p1,
+                                           const FourVector &p2);
+  /// Same for particles, using their cached masses
+  static double cm_momentum_difference_sqr(const Particle &h1,
+                                           const Particle &h2);
+  bool check_vicinity(const Particle &h1, const Particle &h2,
+                      double deltap, double deltar) const;
   void coalesce(const std::vector<Particle> &in,
-                std::vector<Particle> &out);
+                std::vector<Particle> &out, const PairRandom &random,
+                EventArena &arena) const;
   void coalesce_probabilistic(const std::vector<Particle> &in,
-                std::vector<Particle> &out);
-  double get_pair_weight(const Particle &h1, const Particle &h2);
-  void make_nuclei(const std::string &input_file);
-  void add_to_histograms(const Particle &part);
+                std::vector<Particle> &out, EventArena &arena) const;
+  /// Same as above with temporary working memory
+  void coalesce(const std::vector<Particle> &in,
+                std::vector<Particle> &out, const PairRandom &random) const;
+  void coalesce_probabilistic(const std::vector<Particle> &in,
+                std::vector<Particle> &out) const;
+  double get_pair_weight(const Particle &h1, const Particle &h2) const;
+  /**
+   * Random numbers of the pairs of one event. They only depend on the
+   * seed and on the position of the event in the input, so that results
+   * do not depend on the order in which events are processed.
+   */
+  PairRandom event_random(size_t file_index, size_t event_number) const {
+    return PairRandom(seed_, file_index, event_number);
+  }
+  SimdLevel simd_level() const { return simd_level_; }
+  void set_simd_level(SimdLevel level) { simd_level_ = level; }
+  /// Search method for partners in the sharp coalescence
+  PairSearch pair_search() const { return pair_search_; }
+  void set_pair_search(PairSearch method) { pair_search_ = method; }
+  /**
+   * Mix every event with the \p window - 1 events before it in the same
+   * input file, pairing only nucleons from different events. This
+   * estimates the combinatorial background, the nuclei weights are divided
+   * by the number of partner events. A window of 1 is the usual
+   * coalescence within each event. Mixed events have to have a single
+   * particle block, make_nuclei throws std::runtime_error otherwise.
+   */
+  void set_mixing_window(size_t window) { mixing_window_ = window; }
+  /**
+   * Coalesce the events of \p input_file, the \p first_event ones before
+   * are skipped, because they were done before a checkpoint.
+   */
+  void make_nuclei(const std::string &input_file, size_t file_index,
+                   size_t first_event = 0);
+  /**
+   * Write a checkpoint to \p file after each input file and at least
+   * every \p interval seconds between events. Mixed events are only
+   * checkpointed after each file, as the window would be lost.
+   */
+  void set_checkpoint(const std::string &file, double interval);
+  /**
+   * Write a checkpoint now, to continue with \p file_index after
+   * \p events_done of its events. Waits for the output to be written.
+   */
+  void write_checkpoint(size_t file_index, size_t events_done);
+  /**
+   * Continue from \p checkpoint. The seed, which this object was created
+   * with, and the histograms have to be the same as at the checkpoint,
+   * otherwise std::invalid_argument is thrown.
+   */
+  void restore(const Checkpoint &checkpoint);
+  /**
+   * Fill also \p histogram from now on. The rapidity distributions of p,
+   * d and t printed by print_histograms are always filled.
+   */
+  void add_histogram(const Histogram &histogram);
+  const HistogramSet &histograms() const { return histograms_; }
+  /// Number of events coalesced so far and of the ones, which allocated
+  size_t n_arena_events() const;
+  size_t n_arena_allocations() const;
+  /// Add histograms and event count of \p other to the ones of this object
+  void merge_histograms(const HistogramSet &other);
+  /// Write all histograms into \p file
+  void write_histograms(const std::string &file, OutputFormat format) const {
+    histograms_.write(file, format);
+  }
+  /// Copy the content of \p file to the end of the output
+  void append_output(const std::string &file);
+  /**
+   * Wait until all nuclei are written and write them through to the disk.
+   * Errors of the output are thrown from here, on destruction they can
+   * only be printed.
+   */
+  void flush_output();
+  /// Number of the next event, events are numbered across input files
+  void set_event_number(size_t event_number) { event_number_ = event_number; }
   void print_histograms();
  private:
+  // How many events may wait for the writer thread before coalescence stops
+  static constexpr size_t output_queue_size = 256;
+
+  // Hadrons of an event waiting for coalescence and the nuclei made of them
+  struct EventBuffer {
+    size_t event_number;
+    // Known after the end of the event block, NaN before
+    double impact_parameter;
+    std::vector<Particle> hadrons;
+    std::vector<Particle> nuclei;
+    // Whether the hadrons or the mixing slot needed more memory
+    bool grown = false;
+  };
+  /**
+   * Coalesce the first \p n_events of \p events in parallel, then write
+   * them out and fill histograms in the order of events.
+   */
+  template <CutType Cut>
+  void process_events(EventBuffer *events, size_t n_events,
+                      size_t file_index);
+  // Nucleons of an event kept for mixing with the following events
+  struct MixingSlot {
+    std::vector<Particle> nucleons;
+    MomentumGrid grid;
+  };
+  /**
+   * Store the nucleons of the first \p n_events of \p events in the ring
+   * of mixing slots after the \p n_mixed events already there, then pair
+   * each of them with the previous events of the window.
+   */
+  template <CutType Cut>
+  void process_mixed_events(EventBuffer *events, size_t n_events,
+                            std::vector<MixingSlot> &ring, size_t n_mixed);
+  /**
+   * Add the clusters of \p Channel from pairs of a particle of \p event and
+   * one of \p partner
+   */
+  template <CutType Cut, typename Channel>
+  void mix_events(MixingSlot &event, const MixingSlot &partner,
+                  double weight_factor, std::vector<Particle> &nuclei,
+                  EventArena &arena) const;
+  /**
+   * Sharp coalescence in \p Channel, the \p index-th one of the run.
+   * \p indexed tells, which partner finders of the arena are built.
+   */
+  template <typename Channel>
+  void coalesce_channel(size_t index, const PairRandom &random,
+                        EventArena &arena,
+                        std::array<bool, n_particle_types> &indexed,
+                        std::vector<Particle> &nuclei) const;
+  // Calls coalesce_channel for each channel of a list
+  struct ChannelPass;
+  /// Arena of the calling thread
+  EventArena &thread_arena();
+  /// Fill the histograms with a coalesced event
+  void fill_histograms(const EventBuffer &event);
+  /// Fill histograms and write out the nuclei of coalesced events in order
+  void finish_events(EventBuffer *events, size_t n_events);
+  /**
+   * Give every buffer, which is reused by the following events, the memory
+   * of the largest one of its kind so far, twice as much after the first
+   * batch. Called between batches, so that buffers stop growing after the
+   * first batches, instead of each thread, event buffer and writer slot
+   * growing on its own.
+   */
+  void reserve_buffers();
+  /// Spectators are not used for coalescence
+  static bool is_spectator(const Particle &hadron);
+  /// Largest momentum difference q = |p1 - p2| / 2 with a weight above cutoff
+  static double max_wigner_q();
+
   static constexpr double hbarc = 0.197327053;
+  // Width parameter of the deuteron Wigner function [fm^2], see 2012.04352
+  static constexpr double wigner_d2 = 3.2 * 3.2;
+  // Smallest weight of a pair in the probabilistic coalescence
+  static constexpr double weight_cutoff = 1e-6;
+  // Relative tolerance of the invariant pre-filters against rounding, so
+  // that they never reject a pair accepted by the exact tests
+  static constexpr double invariant_tolerance = 1e-9;
+
+  // Seed of the random number generators of all events
+  const uint64_t seed_;
+  // Instruction set of the batched pair kernels
+  SimdLevel simd_level_;
+  // Partner search of the sharp coalescence
+  PairSearch pair_search_ = PairSearch::grid;
 
-  // random number generation
-  std::random_device random_device_;
-  std::mt19937 rng_generator_;
+  // Number of events mixed together, 1 is no mixing
+  size_t mixing_window_ = 1;
 
-  // Particles from how many events will be used for coalescence
-  const int n_events_combined_ = 1;
+  // Histograms of all events so far, filled in the order of events
+  HistogramSet histograms_;
 
-  // Rapidity histograms
-  double y_min_ = -4.0, y_max_ = 4.0;
-  static const int y_nbins_ = 41;
-  std::array<double, y_nbins_> proton_y_, deuteron_y_, triton_y_;
+  // Events of a batch and the ring of mixed events, reused across files
+  std::vector<EventBuffer> events_;
+  std::vector<MixingSlot> mixing_ring_;
+  // Largest memory of nuclei of an event, which is reserved in all event
+  // buffers and writer slots [particles]
+  size_t max_nuclei_ = 0;
+  // Whether reserve_buffers was called after the first batch
+  bool buffers_reserved_ = false;
 
-  ParticleType pdg_to_type(int32_t pdg);
   size_t event_number_ = 0;
-  FILE *output_;
+  // Checkpoint file, none if empty, its interval and when it was written
+  std::string checkpoint_file_;
+  std::chrono::steady_clock::duration checkpoint_interval_{};
+  std::chrono::steady_clock::time_point last_checkpoint_;
+  // One arena per thread of the parallel event loop
+  std::vector<EventArena> arenas_;
+  // Writes nuclei on its own thread, flushed before destruction
+  std::unique_ptr<AsyncNucleiWriter> output_;
   // Coalescence parameters
   const double deuteron_deltap_ = 0.44;  // GeV
   const double deuteron_deltar_ = 2.0 * M_PI * hbarc / deuteron_deltap_;  // fm
   const bool probabilistic_;
+  // Event loops of the cut type of the run, chosen once
+  void (Coalescence::*process_events_)(EventBuffer *, size_t, size_t);
+  void (Coalescence::*process_mixed_events_)(EventBuffer *, size_t,
+                                             std::vector<MixingSlot> &,
+                                             size_t);
 };
 
 }  // namespace coalescence
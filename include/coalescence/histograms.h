@@ -0,0 +1,165 @@
+#ifndef COALESCENCE_HISTOGRAMS_H
+#define COALESCENCE_HISTOGRAMS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "coalescence/nuclei_output.h"
+#include "coalescence/particle.h"
+
+namespace coalescence {
+
+/// Quantity binned along a histogram axis
+enum class HistogramVariable {
+  rapidity,          // y
+  pt,                // transverse momentum [GeV]
+  impact_parameter,  // b [fm], the centrality of the event
+};
+
+/**
+ * Uniform binning of one variable in [min, max) into bins 0 ... n_bins - 1,
+ * with bin -1 for underflow and n_bins for overflow. Infinities are under-
+ * or overflow, a NaN has no bin.
+ */
+struct HistogramAxis {
+  HistogramVariable variable;
+  double min, max;
+  int n_bins;
+
+  /// Returned by bin for a NaN
+  static constexpr int undefined = -2;
+  /// Bin of \p x from -1 to n_bins, or undefined if \p x is a NaN
+  int bin(double x) const;
+  double width() const { return (max - min) / n_bins; }
+  double center(int i) const { return min + (max - min) / n_bins * (i + 0.5); }
+};
+
+/**
+ * Weighted counts of one particle type over one to three axes. If one of
+ * the axes is the impact parameter, the events are counted in its bins as
+ * well, so that yields can be normalized per event of each centrality.
+ * Particles and events with a NaN in one of the variables are not put
+ * into any bin, but counted separately.
+ */
+class Histogram {
+ public:
+  Histogram(ParticleType species, const std::vector<HistogramAxis> &axes);
+
+  /**
+   * Histogram described as "species:variable=min,max,n_bins[:...]" with
+   * variables y, pt and b, for example "d:y=-4,4,40:pt=0,3,30". Throws
+   * std::invalid_argument if the description is not understood.
+   */
+  static Histogram from_spec(const std::string &spec);
+
+  /// Add \p particle of an event with \p impact_parameter
+  void fill(const Particle &particle, double impact_parameter);
+  /// Count an event with \p impact_parameter
+  void add_event(double impact_parameter);
+  /// Add the counts of \p other, which has to have the same binning
+  void merge(const Histogram &other);
+  /// Set all counts to zero
+  void clear();
+  /// Whether \p other has the same type and axes
+  bool same_binning(const Histogram &other) const;
+
+  ParticleType species() const { return species_; }
+  const std::vector<HistogramAxis> &axes() const { return axes_; }
+  /**
+   * Sum of weights in the bin with the given index along each axis,
+   * including -1 and n_bins for under- and overflow
+   */
+  double value(const std::array<int, 3> &bins) const {
+    return values_[flat_index(bins)];
+  }
+  /// Number of events, which fall into the impact parameter bin of \p bins
+  double n_events(const std::array<int, 3> &bins) const;
+  /// Sum of weights of the particles with a NaN in one of the variables
+  double undefined() const { return undefined_; }
+  /// Number of events with a NaN impact parameter, if it is an axis
+  double undefined_events() const { return undefined_events_; }
+  /// Sum of weights per event and per unit of the particle variables
+  double density(const std::array<int, 3> &bins) const;
+
+  void write_text(FILE *output) const;
+  void write_binary(FILE *output) const;
+  /**
+   * Histogram written by write_binary. Throws std::runtime_error if the
+   * input ends early or does not describe a histogram.
+   */
+  static Histogram read_binary(FILE *input);
+
+ private:
+  size_t flat_index(const std::array<int, 3> &bins) const;
+  /// Bins along each axis of the flat index \p index
+  std::array<int, 3> bins_of(size_t index) const;
+
+  ParticleType species_;
+  std::vector<HistogramAxis> axes_;
+  // Sums of weights with n_bins + 2 values along each axis, the first and
+  // last ones are under- and overflow
+  std::vector<double> values_;
+  // Axis of the impact parameter or -1, and the events in each of its bins
+  // including under- and overflow
+  int b_axis_ = -1;
+  std::vector<double> n_events_;
+  // Weights and events without a bin, because of a NaN
+  double undefined_ = 0.0;
+  double undefined_events_ = 0.0;
+};
+
+/**
+ * Histograms filled together, each particle goes to the ones of its type.
+ * They are found through a table of slots by type, so filling does not
+ * test the type of the particle.
+ */
+class HistogramSet {
+ public:
+  void add(const Histogram &histogram);
+  void fill(const Particle &particle, double impact_parameter);
+  void add_event(double impact_parameter);
+  /// Add the counts of \p other, which has to have the same histograms
+  void merge(const HistogramSet &other);
+  void clear();
+
+  size_t size() const { return histograms_.size(); }
+  const Histogram &operator[](size_t i) const { return histograms_[i]; }
+  /// Number of events counted
+  double n_events() const { return n_events_; }
+
+  /**
+   * Write all histograms into \p file. The text format has a block per
+   * histogram with the bin centers, sums of weights and densities. The
+   * binary one starts with
+   *   "HIST", uint16 version, uint32 number of histograms,
+   * followed by each histogram as
+   *   int32 type, uint32 number of axes,
+   *   per axis int32 variable, double min, double max, int32 bins,
+   *   double events per impact parameter bin (one value if there is no
+   *   such axis), double sum of weights per bin,
+   *   double sum of weights and double events with a NaN variable,
+   * where the bins along each axis include under- and overflow.
+   */
+  void write(const std::string &file, OutputFormat format) const;
+  /**
+   * Complete state to continue filling later: double number of events,
+   * then the binary format above without "HIST" and version.
+   */
+  void write_state(FILE *output) const;
+  /// Histograms written by write_state, throws std::runtime_error
+  static HistogramSet read_state(FILE *input);
+
+ private:
+  std::vector<Histogram> histograms_;
+  // Histograms of the type t are slots_[slot_begin_[t] ... slot_begin_[t+1]),
+  // the type n_particle_types stands for invalid particles and has none
+  std::vector<uint32_t> slots_;
+  std::array<uint32_t, n_particle_types + 2> slot_begin_{};
+  double n_events_ = 0.0;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_HISTOGRAMS_H
@@ -0,0 +1,125 @@
+#ifndef COALESCENCE_INSTRUMENTATION_H
+#define COALESCENCE_INSTRUMENTATION_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace coalescence {
+
+/**
+ * Timers and counters of the stages of a run, compiled in if
+ * COALESCENCE_INSTRUMENTATION is defined, which the cmake option of the
+ * same name does.
+ * Every thread adds to its own record, so there is no contention, and
+ * the records are summed for the report. Without the definition the
+ * timers and counters are empty inline code.
+ */
+
+/// Stages of the run, timed separately
+enum class RunStage {
+  read,         // reading the input
+  filter,       // selecting the hadrons for coalescence
+  pair_search,  // indexing and finding candidate partners
+  nuclei,       // testing candidates and building nuclei
+  output,       // handing over and writing nuclei
+  histograms,   // filling histograms
+};
+constexpr size_t n_run_stages =
+    static_cast<size_t>(RunStage::histograms) + 1;
+
+/// Quantities counted during the run
+enum class RunCounter {
+  events,
+  particles_read,      // all particle records of the input
+  nucleons_kept,       // baryons kept for coalescence
+  pairs_tested,        // pairs tested against the cuts or weighted
+  pairs_momentum_cut,  // pairs within the sharp momentum cut
+  pairs_spatial_cut,   // pairs within both sharp cuts
+  nuclei_produced,
+};
+constexpr size_t n_run_counters =
+    static_cast<size_t>(RunCounter::nuclei_produced) + 1;
+
+const char *run_stage_name(RunStage stage);
+const char *run_counter_name(RunCounter counter);
+
+/// Times and counts of one thread, or summed over all threads
+struct RunRecord {
+  std::array<uint64_t, n_run_stages> nanoseconds{};
+  std::array<uint64_t, n_run_stages> calls{};
+  std::array<uint64_t, n_run_counters> counters{};
+};
+
+#ifdef COALESCENCE_INSTRUMENTATION
+constexpr bool instrumentation_enabled = true;
+
+extern thread_local RunRecord *current_run_record;
+/// Record of a new thread, kept until the end of the program
+RunRecord *register_run_record();
+
+inline RunRecord &thread_run_record() {
+  if (current_run_record == nullptr) {
+    current_run_record = register_run_record();
+  }
+  return *current_run_record;
+}
+
+inline void count(RunCounter counter, uint64_t n = 1) {
+  thread_run_record().counters[static_cast<size_t>(counter)] += n;
+}
+
+/// Adds the time from construction to destruction to \p stage
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(RunStage stage) :
+      stage_(static_cast<size_t>(stage)),
+      start_(std::chrono::steady_clock::now()) {}
+  ~ScopedStageTimer() {
+    RunRecord &record = thread_run_record();
+    record.nanoseconds[stage_] += std::chrono::duration_cast<
+        std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_)
+        .count();
+    record.calls[stage_]++;
+  }
+  ScopedStageTimer(const ScopedStageTimer &) = delete;
+  ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+ private:
+  size_t stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+#else
+constexpr bool instrumentation_enabled = false;
+
+inline void count(RunCounter, uint64_t = 1) {}
+
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(RunStage) {}
+  ScopedStageTimer(const ScopedStageTimer &) = delete;
+  ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+};
+#endif
+
+/**
+ * Records of all threads so far summed up, \p n_threads is set to the
+ * number of threads, which recorded something. Should be called when no
+ * other thread is recording.
+ */
+RunRecord run_record_total(size_t &n_threads);
+
+/// Table of the times and counters summed over all threads
+void print_run_report(FILE *output);
+
+/**
+ * The same as a JSON object with "stages" and "counters". Throws
+ * std::runtime_error, if \p file can't be written.
+ */
+void write_run_report_json(const std::string &file);
+
+}  // namespace coalescence
+#endif  // COALESCENCE_INSTRUMENTATION_H
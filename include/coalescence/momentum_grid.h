@@ -0,0 +1,109 @@
+#ifndef COALESCENCE_MOMENTUM_GRID_H
+#define COALESCENCE_MOMENTUM_GRID_H
+
+#include <vector>
+
+#include "coalescence/fourvector.h"
+#include "coalescence/nucleon_store.h"
+#include "coalescence/particle.h"
+#include "coalescence/threevector.h"
+
+namespace coalescence {
+
+/**
+ * Uniform grid over particle momenta, used to find pairs with small
+ * relative momentum in their center of mass frame without looking at
+ * all pairs.
+ *
+ * A momentum is mapped into the unit ball as x = p / (E + m), which is the
+ * Poincare ball model of the mass shell. For two particles the distance in
+ * the ball obeys
+ *   |x1 - x2|^2 = (gamma_rel - 1) (1 - x1^2) (1 - x2^2) / 2
+ *              <= (gamma_rel - 1) / 2,
+ * where gamma_rel = p1.p2 / (m1 m2) is their relative Lorentz factor. A
+ * bound on the momentum difference in the center of mass frame therefore
+ * gives a frame-independent bound on the distance in the ball, and all
+ * possible partners of a particle lie in the neighbouring grid cells.
+ *
+ * Particles are kept as a NucleonStore sorted by cell, so each row of
+ * neighbouring cells is one contiguous block. The exact invariant test on
+ * the momentum difference runs over that block as a vectorized loop.
+ */
+class MomentumGrid {
+ public:
+  /**
+   * Index \p particles on a grid with cells of at least \p cell_size.
+   * Memory of a previous build is reused.
+   */
+  void build(const std::vector<Particle> &particles, double cell_size);
+
+  /**
+   * Find indices of the valid indexed particles, whose momentum difference
+   * to \p p in the center of mass frame of the pair is not larger than
+   * \p deltap, up to a small safety margin. Indices in \p candidates are
+   * ascending.
+   */
+  void find_candidates(const FourVector &p, double deltap,
+                       std::vector<size_t> &candidates);
+
+  /// Exclude the particle with index \p i from further candidates
+  void invalidate(size_t i) { nucleons_.valid[position_[i]] = 0; }
+
+  /// Indexed particles in the order of cells
+  const NucleonStore &nucleons() const { return nucleons_; }
+  /// Bytes of memory reserved by the grid, which is reused by the next build
+  size_t memory_size() const;
+  /// Reserve in each buffer \p factor times the memory reserved by \p other
+  void reserve_like(const MomentumGrid &other, double factor = 1.0);
+  /// Position of the particle with index \p i in nucleons()
+  uint32_t position(size_t i) const {
+    return static_cast<uint32_t>(position_[i]);
+  }
+
+  /**
+   * Largest distance in the ball between particles with masses not
+   * smaller than \p m1 and \p m2, for which the momentum difference in
+   * their center of mass frame is not larger than \p deltap.
+   */
+  static double max_distance(double m1, double m2, double deltap);
+
+  /**
+   * Largest relative Lorentz factor p1.p2 / (m1 m2) of particles with
+   * masses \p m1 and \p m2, whose momentum difference in their center of
+   * mass frame is \p deltap.
+   */
+  static double max_relative_gamma(double m1, double m2, double deltap);
+
+  /// Smallest invariant mass among \p particles
+  static double min_mass(const std::vector<Particle> &particles);
+
+  /// Coordinates of the momentum \p p in the Poincare ball
+  static ThreeVector ball_coordinates(const FourVector &p);
+
+ private:
+  /// Cell coordinate along one axis of a ball coordinate
+  int cell_of(double x) const;
+
+  // Number of cells along each axis and their size
+  int n_cells_ = 1;
+  double cell_size_ = 2.0;
+  // Smallest mass of the indexed particles
+  double min_mass_ = 0.0;
+  // Particles sorted by cell: the ones in cell c are at positions
+  // cell_start_[c] ... cell_start_[c + 1] - 1
+  std::vector<size_t> cell_start_;
+  NucleonStore nucleons_;
+  // Original index of each position and position of each original index
+  std::vector<size_t> index_;
+  std::vector<size_t> position_;
+  // Cell of each particle in the original order
+  std::vector<size_t> cell_;
+  // Next free position in each cell while sorting
+  std::vector<size_t> fill_;
+  // Working memory of the candidate search
+  std::vector<uint32_t> positions_;
+  AlignedVector<uint8_t> scratch_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_MOMENTUM_GRID_H
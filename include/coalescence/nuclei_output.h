@@ -0,0 +1,95 @@
+#ifndef COALESCENCE_NUCLEI_OUTPUT_H
+#define COALESCENCE_NUCLEI_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "coalescence/particle.h"
+
+namespace coalescence {
+
+enum class OutputFormat {
+  text,    // one line per nucleus, printed with %12.8f
+  binary,  // fixed-size records, see BinaryNucleiWriter
+};
+
+/// Write the nuclei of one event in the text layout
+void write_text_event(FILE *output, size_t event_number,
+                      const std::vector<Particle> &nuclei);
+
+/// Output file for the nuclei produced in each event
+class NucleiWriter {
+ public:
+  /**
+   * Open \p output_file for writing nuclei in the \p format. Compression
+   * is only available for the binary format. With a \p resume_offset the
+   * file of an interrupted run is cut to this size, which it had at a
+   * checkpoint, and continued. Otherwise a new file is written.
+   */
+  static std::unique_ptr<NucleiWriter> create(const std::string &output_file,
+                                              OutputFormat format,
+                                              bool compress,
+                                              uint64_t resume_offset = 0);
+  virtual ~NucleiWriter();
+  virtual void write_event(size_t event_number,
+                           const std::vector<Particle> &nuclei) = 0;
+  /**
+   * Append the nuclei of \p file, written before by a writer of the same
+   * format, after the ones written so far.
+   */
+  virtual void append(const std::string &file) = 0;
+  /// Write everything so far through to the disk
+  virtual void flush();
+  /// Size of the file, complete after flush()
+  uint64_t size() const;
+
+ protected:
+  NucleiWriter(const std::string &output_file, uint64_t resume_offset);
+  /// Copy \p input from the current position to its end into the output
+  void copy_rest(FILE *input, const std::string &file);
+
+  std::string output_file_;
+  FILE *output_;
+};
+
+/**
+ * Reader of the binary nuclei output. The file starts with the header
+ *   "NUCL", uint16 version, uint16 flags (bit 0: zlib compression),
+ * followed by event blocks
+ *   'e', uint64 event number, uint32 number of nuclei,
+ * each followed by one record per nucleus
+ *   double p0, px, py, pz, t, x, y, z,
+ *   int32 type, pdg_mother1, pdg_mother2, double weight.
+ * In a compressed file the event blocks are packed into chunks
+ *   'z', uint32 compressed size, uint32 uncompressed size, zlib data.
+ * Either way files can be joined at block boundaries.
+ */
+class BinaryNucleiReader {
+ public:
+  explicit BinaryNucleiReader(const std::string &input_file);
+  ~BinaryNucleiReader();
+  BinaryNucleiReader(const BinaryNucleiReader &) = delete;
+  BinaryNucleiReader &operator=(const BinaryNucleiReader &) = delete;
+
+  /// Read the next event, false at the end of the file
+  bool read_event(size_t &event_number, std::vector<Particle> &nuclei);
+
+ private:
+  /// Get the next \p n bytes of event blocks, false at the end of file
+  bool next_bytes(void *dest, size_t n);
+
+  std::string input_file_;
+  FILE *input_;
+  bool compressed_;
+  // Uncompressed content of the current chunk and position in it
+  std::vector<char> chunk_;
+  size_t chunk_position_ = 0;
+  std::vector<unsigned char> compressed_chunk_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_NUCLEI_OUTPUT_H
@@ -0,0 +1,113 @@
+#ifndef COALESCENCE_NUCLEON_STORE_H
+#define COALESCENCE_NUCLEON_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "coalescence/fourvector.h"
+#include "coalescence/particle.h"
+
+namespace coalescence {
+
+/// Allocator returning memory aligned to \p Alignment bytes
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+  typedef T value_type;
+  template <typename U>
+  struct rebind {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+  T *allocate(size_t n) {
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(ptr);
+  }
+  void deallocate(T *ptr, size_t) { std::free(ptr); }
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment> &,
+                const AlignedAllocator<U, Alignment> &) {
+  return true;
+}
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment> &,
+                const AlignedAllocator<U, Alignment> &) {
+  return false;
+}
+
+/// Vector with storage aligned to the cache line, suitable for SIMD loads
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, 64>>;
+
+/**
+ * \p factor times \p capacity elements, for reserving reused buffers. A
+ * \p factor above one adds headroom for at least 16 more elements, so that
+ * buffers which are still empty or small have room for rare large events.
+ */
+inline size_t scaled_capacity(size_t capacity, double factor) {
+  return static_cast<size_t>(factor * capacity + (factor - 1.0) * 16);
+}
+
+/**
+ * Nucleons of an event stored as structure of arrays: momentum, squared
+ * mass, origin and validity in separate contiguous arrays. Loops over a
+ * block of partners then run over plain arrays of doubles and are
+ * vectorized by the compiler. The momenta are kept in single precision as
+ * well, for the pre-filter of candidate partners, with the light-cone
+ * components E + pz and E - pz in place of E and pz.
+ */
+struct NucleonStore {
+  AlignedVector<double> e, px, py, pz, m2;
+  AlignedVector<double> t, x, y, z;
+  AlignedVector<uint8_t> valid;
+  AlignedVector<float> plus_f, minus_f, px_f, py_f, m2_f;
+
+  size_t size() const { return e.size(); }
+  /// Number of nucleons, which fit without reallocation
+  size_t capacity() const { return e.capacity(); }
+  /// Bytes of memory reserved by the arrays
+  size_t memory_size() const {
+    return capacity() * (9 * sizeof(double) + sizeof(uint8_t) +
+                         5 * sizeof(float));
+  }
+  void clear();
+  void reserve(size_t n);
+  void push_back(const Particle &particle);
+
+  /**
+   * Append to \p positions the positions in [begin, end) of valid
+   * nucleons, whose squared momentum difference to \p p in the center of
+   * mass frame of the pair does not exceed \p max_dp2.
+   * \p scratch is working memory of the kernel.
+   */
+  void select_close_momenta(const FourVector &p, double max_dp2,
+                            size_t begin, size_t end,
+                            std::vector<uint32_t> &positions,
+                            AlignedVector<uint8_t> &scratch) const;
+
+  /**
+   * Same selection computed in single precision, which fits twice as many
+   * pairs into a SIMD register. The test is widened by a bound on its
+   * rounding error, so that it selects every nucleon selected by
+   * select_close_momenta and only rarely a few more. The exact tests of
+   * the candidates in double precision decide about them.
+   */
+  void prefilter_close_momenta(const FourVector &p, double max_dp2,
+                               size_t begin, size_t end,
+                               std::vector<uint32_t> &positions,
+                               AlignedVector<uint8_t> &scratch) const;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_NUCLEON_STORE_H
@@ -0,0 +1,77 @@
+#ifndef COALESCENCE_PAIR_RANDOM_H
+#define COALESCENCE_PAIR_RANDOM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace coalescence {
+
+/**
+ * Philox4x32-10 counter-based random number generator of Salmon et al.,
+ * "Parallel random numbers: as easy as 1, 2, 3" (SC11). The 128-bit
+ * output is a bijective function of the 128-bit \p counter for each
+ * 64-bit \p key, so any number of independent streams are obtained by
+ * choosing counters, without any state shared between threads.
+ */
+inline std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> counter,
+                                          std::array<uint32_t, 2> key) {
+  constexpr uint64_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+  constexpr uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+  for (int round = 0; round < 10; round++) {
+    if (round > 0) {
+      key[0] += w0;
+      key[1] += w1;
+    }
+    const uint64_t p0 = m0 * counter[0], p1 = m1 * counter[2];
+    counter = {static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ key[0],
+               static_cast<uint32_t>(p1),
+               static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ key[1],
+               static_cast<uint32_t>(p0)};
+  }
+  return counter;
+}
+
+/**
+ * Uniform random numbers in [0, 1) for the pairs of one event. The number
+ * of a pair is a function of the seed, the file and event, the channel and
+ * the indices of the two particles alone, so it does not depend on which
+ * thread draws it, in which order, or whether it is drawn at all. Pairs
+ * can therefore be rejected by the cuts before drawing.
+ *
+ * The seed is the key of Philox4x32, the counter consists of the indices
+ * i and j, the lower 32 bits of the event number, and the channel (8 bits)
+ * together with the lower 24 bits of the file index.
+ */
+class PairRandom {
+ public:
+  PairRandom(uint64_t seed, size_t file_index, size_t event_number) :
+      key_{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+      event_(static_cast<uint32_t>(event_number)),
+      file_(static_cast<uint32_t>(file_index) & 0xFFFFFF) {}
+
+  /// Number of the pair (\p i, \p j) in \p channel
+  double uniform(uint32_t channel, uint32_t i, uint32_t j) const {
+    const std::array<uint32_t, 4> x = philox4x32(
+        {i, j, event_, (channel << 24) | file_}, key_);
+    // 53 random bits from the first two words
+    return ((x[0] >> 5) * 67108864.0 + (x[1] >> 6)) *
+           (1.0 / 9007199254740992.0);
+  }
+
+  /// Numbers of the pairs (\p i, \p j[k]) for k < \p n, as a simple loop
+  void uniform(uint32_t channel, uint32_t i, const uint32_t *j, size_t n,
+               double *out) const {
+    for (size_t k = 0; k < n; k++) {
+      out[k] = uniform(channel, i, j[k]);
+    }
+  }
+
+ private:
+  std::array<uint32_t, 2> key_;
+  uint32_t event_;
+  uint32_t file_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_PAIR_RANDOM_H
@@ -0,0 +1,56 @@
+#ifndef COALESCENCE_PAIR_SEARCH_H
+#define COALESCENCE_PAIR_SEARCH_H
+
+#include <string>
+#include <vector>
+
+#include "coalescence/fourvector.h"
+#include "coalescence/momentum_grid.h"
+#include "coalescence/particle.h"
+#include "coalescence/rapidity_sweep.h"
+
+namespace coalescence {
+
+/// How partners with small relative momentum are searched for
+enum class PairSearch {
+  grid,      // MomentumGrid over the Poincare ball
+  rapidity,  // RapiditySweep over a window of rapidities
+  brute,     // test of all particles
+};
+
+/// Name of \p method as given on the command line
+const char *pair_search_name(PairSearch method);
+/// Method of a given name, throws std::invalid_argument if there is none
+PairSearch pair_search_from_name(const std::string &name);
+
+/**
+ * Candidate partners by one of the search methods. All methods apply the
+ * same exact invariant test, so they find the same candidates and only
+ * differ in how many particles they look at.
+ */
+class PairFinder {
+ public:
+  /// Index \p particles for partners within \p deltap by \p method
+  void build(const std::vector<Particle> &particles, double deltap,
+             PairSearch method);
+
+  /// See MomentumGrid::find_candidates
+  void find_candidates(const FourVector &p, double deltap,
+                       std::vector<size_t> &candidates);
+
+  /// Exclude the particle with index \p i from further candidates
+  void invalidate(size_t i);
+
+  /// Bytes of memory reserved, which is reused by the next build
+  size_t memory_size() const;
+  /// Reserve in each buffer \p factor times the memory reserved by \p other
+  void reserve_like(const PairFinder &other, double factor = 1.0);
+
+ private:
+  PairSearch method_ = PairSearch::grid;
+  MomentumGrid grid_;
+  RapiditySweep sweep_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_PAIR_SEARCH_H
@@ -0,0 +1,39 @@
+#ifndef COALESCENCE_PAIR_WEIGHT_KERNEL_H
+#define COALESCENCE_PAIR_WEIGHT_KERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "coalescence/fourvector.h"
+#include "coalescence/nucleon_store.h"
+
+namespace coalescence {
+
+/// Instruction sets, for which the batched pair kernels are available
+enum class SimdLevel {
+  scalar,
+  avx2,    // 4 pairs at once
+  avx512,  // 8 pairs at once
+};
+
+/// Widest instruction set supported by both the build and the CPU
+SimdLevel best_simd_level();
+const char *simd_level_name(SimdLevel level);
+
+/**
+ * Deuteron Wigner function weights 3 exp(-dr^2 / d^2 - q^2 d^2 / hbarc^2)
+ * of the nucleon with momentum \p p and origin \p r against the nucleons
+ * at \p positions[0 ... n - 1] of \p partners. The computation is the same
+ * as in Coalescence::get_pair_weight, but done for 4 or 8 pairs at once
+ * with the instruction set \p level, including a vectorized exponent.
+ *
+ * \param[in] d2 width of the Wigner function d^2 [fm^2]
+ * \param[in] hbarc hbar * c [GeV fm]
+ * \param[out] weights n weights in the order of \p positions
+ */
+void pair_weights(SimdLevel level, const FourVector &p, const FourVector &r,
+                  const NucleonStore &partners, const uint32_t *positions,
+                  size_t n, double d2, double hbarc, double *weights);
+
+}  // namespace coalescence
+#endif  // COALESCENCE_PAIR_WEIGHT_KERNEL_H
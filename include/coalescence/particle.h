@@ -0,0 +1,112 @@
+#ifndef COALESCENCE_PARTICLE_H
+#define COALESCENCE_PARTICLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "coalescence/fourvector.h"
+#include "coalescence/threevector.h"
+
+namespace coalescence {
+
+enum class ParticleType : char {
+  boring, // hadrons not interesting for coalescence
+  p,    // proton
+  n,    // neutron
+  la,   // lambda
+  sig0, // Sigma0
+  ap,   // anti-proton
+  an,   // anti-neuton
+  ala,  // anti-lambda
+  asig0, // anti-Sigma0
+  d,     // deuteron
+  t,     // triton
+  He3,   // Helium-3
+  H3L,   // Hypertriton
+  He4_0, // Helium-4 ground state
+  ad,    // anti-deuteron
+  at,    // anti-triton
+  aHe3,  // anti-Helium-3
+  // ...
+};
+
+/// Number of particle types, has to follow the last one above
+constexpr size_t n_particle_types =
+    static_cast<size_t>(ParticleType::aHe3) + 1;
+
+/// Quantities derived from the momentum, computed once per particle
+struct Kinematics {
+  ThreeVector velocity;
+  double mass;
+  double rapidity;
+  double pt;  // transverse momentum
+};
+
+inline Kinematics kinematics_of(const FourVector &p) {
+  return {p.velocity(), std::sqrt(std::max(p.sqr(), 0.0)),
+          0.5 * std::log((p[0] + p[3]) / (p[0] - p[3])),
+          std::sqrt(p[1] * p[1] + p[2] * p[2])};
+}
+
+struct Particle {
+  FourVector momentum;  // 4-momentum
+  FourVector origin;    // 4-position of origin
+  ParticleType type;
+  int32_t pdg_mother1;
+  int32_t pdg_mother2;
+  double weight;
+  bool valid;
+  Kinematics kin;       // derived from momentum
+};
+
+/// Valid particle with kinematics derived from \p momentum
+inline Particle make_particle(const FourVector &momentum,
+                              const FourVector &origin, ParticleType type,
+                              int32_t pdg_mother1, int32_t pdg_mother2,
+                              double weight) {
+  return {momentum, origin, type, pdg_mother1, pdg_mother2, weight, true,
+          kinematics_of(momentum)};
+}
+
+inline ParticleType pdg_to_type(int32_t pdg) {
+  switch (pdg) {
+    case 2212:  return ParticleType::p;
+    case 2112:  return ParticleType::n;
+    case 3122:  return ParticleType::la;
+    case 3212:  return ParticleType::sig0;
+    case -2212: return ParticleType::ap;
+    case -2112: return ParticleType::an;
+    case -3122: return ParticleType::ala;
+    case -3212:  return ParticleType::asig0;
+    default: return ParticleType::boring;
+  };
+}
+
+/// PDG code of a particle type, 0 for uninteresting hadrons
+inline int32_t type_to_pdg(ParticleType type) {
+  switch (type) {
+    case ParticleType::p:     return 2212;
+    case ParticleType::n:     return 2112;
+    case ParticleType::la:    return 3122;
+    case ParticleType::sig0:  return 3212;
+    case ParticleType::ap:    return -2212;
+    case ParticleType::an:    return -2112;
+    case ParticleType::ala:   return -3122;
+    case ParticleType::asig0: return -3212;
+    case ParticleType::d:     return 1000010020;
+    case ParticleType::t:     return 1000010030;
+    case ParticleType::He3:   return 1000020030;
+    case ParticleType::H3L:   return 1010010030;
+    case ParticleType::He4_0: return 1000020040;
+    case ParticleType::ad:    return -1000010020;
+    case ParticleType::at:    return -1000010030;
+    case ParticleType::aHe3:  return -1000020030;
+    case ParticleType::boring: break;
+  };
+  return 0;
+}
+
+}  // namespace coalescence
+#endif  // COALESCENCE_PARTICLE_H
@@ -0,0 +1,78 @@
+#ifndef COALESCENCE_RAPIDITY_SWEEP_H
+#define COALESCENCE_RAPIDITY_SWEEP_H
+
+#include <vector>
+
+#include "coalescence/fourvector.h"
+#include "coalescence/nucleon_store.h"
+#include "coalescence/particle.h"
+
+namespace coalescence {
+
+/**
+ * Particles sorted by rapidity, used to find pairs with small relative
+ * momentum in their center of mass frame.
+ *
+ * For two particles with rapidity difference dy
+ *   gamma_rel = p1.p2 / (m1 m2)
+ *             = (mT1 mT2 cosh(dy) - pT1.pT2) / (m1 m2) >= cosh(dy),
+ * so a bound on the momentum difference in the center of mass frame
+ * bounds dy, and the possible partners of a particle form a contiguous
+ * window of the sorted particles. The window is filtered by the same
+ * exact invariant test as in MomentumGrid, so both give the same
+ * candidates. The azimuth is not used, because at small pT particles
+ * with close momenta may have any azimuthal difference.
+ */
+class RapiditySweep {
+ public:
+  /// Sort \p particles by rapidity, memory of a previous build is reused
+  void build(const std::vector<Particle> &particles);
+
+  /**
+   * Find indices of the valid particles, whose momentum difference to \p p
+   * in the center of mass frame of the pair is not larger than \p deltap,
+   * up to a small safety margin. Only the rapidity window allowed by
+   * \p deltap is tested. Indices in \p candidates are ascending.
+   */
+  void find_candidates(const FourVector &p, double deltap,
+                       std::vector<size_t> &candidates);
+
+  /// Same as find_candidates, but testing all particles
+  void find_all_candidates(const FourVector &p, double deltap,
+                           std::vector<size_t> &candidates);
+
+  /// Exclude the particle with index \p i from further candidates
+  void invalidate(size_t i) { nucleons_.valid[position_[i]] = 0; }
+
+  /// Bytes of memory reserved, which is reused by the next build
+  size_t memory_size() const;
+  /// Reserve in each buffer \p factor times the memory reserved by \p other
+  void reserve_like(const RapiditySweep &other, double factor = 1.0);
+
+  /**
+   * Largest rapidity difference of particles with masses not smaller than
+   * \p m1 and \p m2, for which the momentum difference in their center of
+   * mass frame is not larger than \p deltap.
+   */
+  static double max_rapidity_difference(double m1, double m2, double deltap);
+
+ private:
+  /// Test the positions [begin, end) and put the passing ones to candidates
+  void select(const FourVector &p, double deltap, size_t begin, size_t end,
+              std::vector<size_t> &candidates);
+
+  // Smallest mass of the sorted particles
+  double min_mass_ = 0.0;
+  // Rapidities in ascending order and the particles in the same order
+  std::vector<double> rapidity_;
+  NucleonStore nucleons_;
+  // Original index of each position and position of each original index
+  std::vector<size_t> index_;
+  std::vector<size_t> position_;
+  // Working memory of the candidate search
+  std::vector<uint32_t> positions_;
+  AlignedVector<uint8_t> scratch_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_RAPIDITY_SWEEP_H
@@ -0,0 +1,80 @@
+#ifndef COALESCENCE_SMASH_BINARY_READER_H
+#define COALESCENCE_SMASH_BINARY_READER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "coalescence/particle.h"
+#include "coalescence/smash_record_layout.h"
+
+namespace coalescence {
+
+/**
+ * Reader of the extended SMASH binary output.
+ *
+ * Particle blocks are read from the file with a single bulk read into an
+ * internal buffer and the fixed-size particle records are decoded from
+ * there, instead of issuing one library call per field. Records of
+ * hadrons that are irrelevant for coalescence are recognized by their pdg
+ * code and skipped without being decoded.
+ */
+class SmashBinaryReader {
+ public:
+  /// Kind of the block returned by read_block
+  enum class Block {
+    particles,  // 'p' block
+    event_end,  // 'f' block
+    end_of_input,
+  };
+
+  explicit SmashBinaryReader(const std::string &input_file);
+  SmashBinaryReader(const SmashBinaryReader &) = delete;
+  SmashBinaryReader &operator=(const SmashBinaryReader &) = delete;
+
+  /**
+   * Read the next block of the file. Hadrons of a particle block that are
+   * interesting for coalescence are appended to \p hadrons.
+   */
+  Block read_block(std::vector<Particle> &hadrons);
+
+  /// Number of events in \p input_file, counted without decoding particles
+  static size_t count_events(const std::string &input_file);
+
+  uint16_t format_version() const { return format_version_; }
+  const std::string &smash_version() const { return smash_version_; }
+  /// Event number and impact parameter from the last 'f' block
+  uint32_t event() const { return event_; }
+  double impact_parameter() const { return impact_parameter_; }
+  /// Number of particle records kept so far / skipped as not interesting
+  size_t n_kept() const { return n_kept_; }
+  size_t n_skipped() const { return n_skipped_; }
+
+  /// Size of one particle record in the extended format [bytes]
+  static constexpr size_t record_size = smash_record::size;
+
+ private:
+  /// Read exactly \p n bytes, throw if the file ends before
+  void read_bytes(void *dest, size_t n);
+
+  std::string input_file_;
+  // Buffer for stdio, so that small reads do not go to the disk. It is
+  // used until the file is closed, so it has to be destroyed after it.
+  std::vector<char> stdio_buffer_;
+  // Closed also if the constructor throws
+  std::unique_ptr<FILE, int (*)(FILE *)> input_;
+  uint16_t format_version_;
+  uint16_t format_variant_;
+  std::string smash_version_;
+  uint32_t event_ = 0;
+  double impact_parameter_ = 0.0;
+  size_t n_kept_ = 0;
+  size_t n_skipped_ = 0;
+  // Raw content of the current particle block
+  std::vector<char> buffer_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_SMASH_BINARY_READER_H
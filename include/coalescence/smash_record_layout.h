@@ -0,0 +1,37 @@
+#ifndef COALESCENCE_SMASH_RECORD_LAYOUT_H
+#define COALESCENCE_SMASH_RECORD_LAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace coalescence {
+
+/**
+ * Layout of a particle record in the extended SMASH binary output, shared
+ * by the reader and the generator of synthetic files. Fields are stored
+ * unaligned in the byte order of the machine.
+ */
+namespace smash_record {
+
+/// Field offsets inside of the record [bytes]
+namespace offset {
+constexpr size_t t = 0, x = 8, y = 16, z = 24, m = 32,
+                 p0 = 40, px = 48, py = 56, pz = 64,
+                 pdg = 72, id = 76, charge = 80, ncoll = 84,
+                 form_time = 88, xsecfac = 96,
+                 proc_id_origin = 104, proc_type_origin = 108,
+                 time_last_coll = 112,
+                 pdg_mother1 = 120, pdg_mother2 = 124;
+}  // namespace offset
+
+/// Size of one record [bytes]
+constexpr size_t size = 9 * sizeof(double) + 4 * sizeof(int32_t) +
+    2 * sizeof(double) + 2 * sizeof(int32_t) + sizeof(double) +
+    2 * sizeof(int32_t);
+
+static_assert(offset::pdg_mother2 + sizeof(int32_t) == size,
+              "Extended SMASH particle record layout is inconsistent");
+
+}  // namespace smash_record
+}  // namespace coalescence
+#endif  // COALESCENCE_SMASH_RECORD_LAYOUT_H
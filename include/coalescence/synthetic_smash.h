@@ -0,0 +1,88 @@
+#ifndef COALESCENCE_SYNTHETIC_SMASH_H
+#define COALESCENCE_SYNTHETIC_SMASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "coalescence/fourvector.h"
+#include "coalescence/particle.h"
+
+namespace coalescence {
+
+/// Parameters of synthetic events
+struct SyntheticEventConfig {
+  size_t n_events = 10;
+  size_t multiplicity = 1000;        // hadrons per event
+  double nucleon_fraction = 0.2;     // protons and neutrons, equally many
+  double antinucleon_fraction = 0.0; // antiprotons and antineutrons
+  double hyperon_fraction = 0.02;    // lambdas and Sigma0
+  // The rest are pions and a tenth of them kaons
+  double temperature = 0.15;         // of the local Boltzmann spectra [GeV]
+  double rapidity_width = 1.5;       // half width of the flat rapidity plateau
+  double radius = 6.0;               // Gaussian transverse width [fm]
+  double tau = 10.0;                 // smallest freeze-out proper time [fm]
+  double tau_spread = 5.0;           // of the uniform proper times [fm]
+  double max_impact_parameter = 10.0;  // [fm]
+  uint16_t format_version = 7;       // 'f' blocks have an extra byte if > 6
+  uint64_t seed = 1;
+};
+
+/// Hadron of a synthetic event, as stored in a particle record
+struct SyntheticHadron {
+  int32_t pdg;
+  double mass;
+  FourVector momentum;
+  FourVector origin;
+};
+
+/**
+ * Generator of events in the extended SMASH binary format, for testing and
+ * benchmarking the reader and the coalescence without SMASH output.
+ *
+ * Each hadron is emitted by a fluid cell moving with a longitudinal
+ * rapidity uniform in the plateau, with a Boltzmann momentum in the frame
+ * of the cell. Its origin follows the Bjorken correlation t = tau cosh y,
+ * z = tau sinh y with Gaussian transverse coordinates. Impact parameters
+ * are distributed as b db up to the largest one. All hadrons have mothers,
+ * so none of them look like spectators. The events only depend on the
+ * configuration including the seed.
+ */
+class SyntheticSmashGenerator {
+ public:
+  /// Throws std::invalid_argument for an inconsistent configuration
+  explicit SyntheticSmashGenerator(const SyntheticEventConfig &config);
+
+  /// Hadrons of the next event and its impact parameter
+  void generate_event(std::vector<SyntheticHadron> &hadrons,
+                      double &impact_parameter);
+
+  /**
+   * Write config.n_events events to \p file. Throws std::runtime_error,
+   * if the file can't be written.
+   */
+  void write(const std::string &file);
+
+  /// Hadrons interesting for coalescence as particles, like the reader
+  static std::vector<Particle> to_particles(
+      const std::vector<SyntheticHadron> &hadrons);
+  /// Particles of the first event of a generator with \p config
+  static std::vector<Particle> event_particles(
+      const SyntheticEventConfig &config);
+  /// Protons and neutrons of one event with \p n nucleons
+  static std::vector<Particle> nucleons(size_t n, uint64_t seed);
+
+  const SyntheticEventConfig &config() const { return config_; }
+
+ private:
+  /// Momentum magnitude from p^2 exp(-E / T) for a hadron of mass \p m
+  double thermal_momentum(double m);
+
+  SyntheticEventConfig config_;
+  std::mt19937_64 rng_;
+};
+
+}  // namespace coalescence
+#endif  // COALESCENCE_SYNTHETIC_SMASH_H
@@ -0,0 +1,109 @@
+#include "coalescence/async_writer.h"
+
+#include "coalescence/instrumentation.h"
+
+namespace coalescence {
+
+AsyncNucleiWriter::AsyncNucleiWriter(std::unique_ptr<NucleiWriter> writer,
+                                     size_t capacity) :
+    writer_(std::move(writer)),
+    slots_(capacity),
+    n_queued_(0),
+    n_written_(0),
+    stop_(false),
+    failed_(false) {
+  thread_ = std::thread(&AsyncNucleiWriter::run, this);
+}
+
+AsyncNucleiWriter::~AsyncNucleiWriter() {
+  stop_.store(true, std::memory_order_release);
+  notify(queued_);
+  thread_.join();
+}
+
+void AsyncNucleiWriter::notify(std::condition_variable &condition) {
+  // Taking the mutex orders the change of the counter before or after the
+  // check of the waiting side, which then either sees it or gets notified
+  { std::lock_guard<std::mutex> lock(mutex_); }
+  condition.notify_one();
+}
+
+void AsyncNucleiWriter::run() {
+  while (true) {
+    const size_t n_written = n_written_.load(std::memory_order_relaxed);
+    if (n_written == n_queued_.load(std::memory_order_acquire)) {
+      // Nothing to do, finish if asked to, otherwise wait for an event
+      std::unique_lock<std::mutex> lock(mutex_);
+      queued_.wait(lock, [&]() {
+        return n_written != n_queued_.load(std::memory_order_acquire) ||
+               stop_.load(std::memory_order_acquire);
+      });
+      if (n_written == n_queued_.load(std::memory_order_acquire)) {
+        return;
+      }
+      continue;
+    }
+    Slot &slot = slots_[n_written % slots_.size()];
+    if (!failed_.load(std::memory_order_relaxed)) {
+      try {
+        ScopedStageTimer timer(RunStage::output);
+        writer_->write_event(slot.event_number, slot.nuclei);
+      } catch (...) {
+        error_ = std::current_exception();
+        failed_.store(true, std::memory_order_release);
+      }
+    }
+    slot.nuclei.clear();
+    n_written_.store(n_written + 1, std::memory_order_release);
+    notify(written_);
+  }
+}
+
+void AsyncNucleiWriter::check_error() {
+  if (failed_.load(std::memory_order_acquire)) {
+    std::rethrow_exception(error_);
+  }
+}
+
+void AsyncNucleiWriter::write_event(size_t event_number,
+                                    std::vector<Particle> &nuclei) {
+  check_error();
+  const size_t n_queued = n_queued_.load(std::memory_order_relaxed);
+  // Wait for a free slot
+  if (n_queued - n_written_.load(std::memory_order_acquire) >=
+      slots_.size()) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_.wait(lock, [&]() {
+      return n_queued - n_written_.load(std::memory_order_acquire) <
+             slots_.size();
+    });
+  }
+  Slot &slot = slots_[n_queued % slots_.size()];
+  slot.event_number = event_number;
+  slot.nuclei.swap(nuclei);
+  n_queued_.store(n_queued + 1, std::memory_order_release);
+  notify(queued_);
+}
+
+void AsyncNucleiWriter::reserve(size_t n_nuclei) {
+  // Slots from the next one to be queued up to the last one written are
+  // not used by the writer thread
+  const size_t n_queued = n_queued_.load(std::memory_order_relaxed);
+  const size_t n_written = n_written_.load(std::memory_order_acquire);
+  for (size_t k = n_queued; k < n_written + slots_.size(); k++) {
+    slots_[k % slots_.size()].nuclei.reserve(n_nuclei);
+  }
+}
+
+void AsyncNucleiWriter::flush() {
+  const size_t n_queued = n_queued_.load(std::memory_order_relaxed);
+  if (n_written_.load(std::memory_order_acquire) != n_queued) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_.wait(lock, [&]() {
+      return n_written_.load(std::memory_order_acquire) == n_queued;
+    });
+  }
+  check_error();
+}
+
+}  // namespace coalescence
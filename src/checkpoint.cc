@@ -0,0 +1,71 @@
+#include "coalescence/checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace coalescence {
+
+namespace {
+
+constexpr char magic_number[4] = {'C', 'K', 'P', 'T'};
+constexpr uint16_t checkpoint_version = 2;
+
+}  // unnamed namespace
+
+void Checkpoint::write(const std::string &file) const {
+  const std::string temporary = file + ".tmp";
+  FILE *output = std::fopen(temporary.c_str(), "wb");
+  if (output == NULL) {
+    throw std::runtime_error("Can't open file " + temporary);
+  }
+  std::fwrite(magic_number, 1, sizeof(magic_number), output);
+  std::fwrite(&checkpoint_version, sizeof(uint16_t), 1, output);
+  for (uint64_t value : {seed, event_number, file_index, events_done,
+                         output_size}) {
+    std::fwrite(&value, sizeof(uint64_t), 1, output);
+  }
+  histograms.write_state(output);
+  const bool failed = std::ferror(output) != 0 ||
+                      std::fflush(output) != 0 ||
+                      fsync(fileno(output)) != 0;
+  if (std::fclose(output) != 0 || failed ||
+      std::rename(temporary.c_str(), file.c_str()) != 0) {
+    throw std::runtime_error("Failed to write checkpoint " + file);
+  }
+}
+
+Checkpoint Checkpoint::read(const std::string &file) {
+  FILE *input = std::fopen(file.c_str(), "rb");
+  if (input == NULL) {
+    throw std::runtime_error("Can't open file " + file);
+  }
+  Checkpoint checkpoint;
+  try {
+    char magic[sizeof(magic_number)];
+    uint16_t version;
+    if (std::fread(magic, 1, sizeof(magic), input) != sizeof(magic) ||
+        std::memcmp(magic, magic_number, sizeof(magic)) != 0 ||
+        std::fread(&version, sizeof(uint16_t), 1, input) != 1 ||
+        version != checkpoint_version) {
+      throw std::runtime_error("not a checkpoint of this version");
+    }
+    for (uint64_t *value : {&checkpoint.seed, &checkpoint.event_number,
+                            &checkpoint.file_index, &checkpoint.events_done,
+                            &checkpoint.output_size}) {
+      if (std::fread(value, sizeof(uint64_t), 1, input) != 1) {
+        throw std::runtime_error("unexpected end of file");
+      }
+    }
+    checkpoint.histograms = HistogramSet::read_state(input);
+  } catch (std::runtime_error &error) {
+    std::fclose(input);
+    throw std::runtime_error("Invalid checkpoint " + file + ": " +
+                             error.what());
+  }
+  std::fclose(input);
+  return checkpoint;
+}
+
+}  // namespace coalescence
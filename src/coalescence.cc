@@ -1,189 +1,555 @@
 #include "coalescence/coalescence.h"
 #include "coalescence/threevector.h"
 #include "coalescence/fourvector.h"
+#include "coalescence/instrumentation.h"
+#include "coalescence/momentum_grid.h"
+#include "coalescence/pair_weight_kernel.h"
+#include "coalescence/smash_binary_reader.h"
 
 #include <algorithm>
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <cassert>
+#include <string>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace coalescence {
 
+namespace {
+/// Deuterons from protons and neutrons, (3 / 4) * (1 / 2)
+typedef ClusterChannel<ParticleType::p, ParticleType::n, ParticleType::d,
+                       3, 8> DeuteronChannel;
+/**
+ * Channels in the order they are tried. Each type is produced before it
+ * is used as b. The factors are the spin average over the initial and
+ * the spin sum over the final states times the isospin projection, see
+ * DOI: 10.1103/PhysRevC.53.367.
+ */
+typedef ChannelList<
+  DeuteronChannel,
+  ClusterChannel<ParticleType::d, ParticleType::p, ParticleType::He3, 1, 4>,
+  ClusterChannel<ParticleType::d, ParticleType::n, ParticleType::t, 1, 4>,
+  // Spin 1 + 1/2 into 1/2, the Sigma0 decays into a Lambda
+  ClusterChannel<ParticleType::d, ParticleType::la, ParticleType::H3L, 1, 3>,
+  ClusterChannel<ParticleType::d, ParticleType::sig0, ParticleType::H3L,
+                 1, 3>,
+  // Spin 1/2 + 1/2 into 0 and isospin 1/2 + 1/2 into 0
+  ClusterChannel<ParticleType::t, ParticleType::p, ParticleType::He4_0,
+                 1, 8>,
+  ClusterChannel<ParticleType::He3, ParticleType::n, ParticleType::He4_0,
+                 1, 8>,
+  // Spin 1 + 1 into 0
+  ClusterChannel<ParticleType::d, ParticleType::d, ParticleType::He4_0,
+                 1, 9>,
+  // Antinuclei with the same factors
+  ClusterChannel<ParticleType::ap, ParticleType::an, ParticleType::ad, 3, 8>,
+  ClusterChannel<ParticleType::ad, ParticleType::ap, ParticleType::aHe3,
+                 1, 4>,
+  ClusterChannel<ParticleType::ad, ParticleType::an, ParticleType::at, 1, 4>
+> ClusterChannels;
+// The channel is part of the counter of the pair random numbers
+static_assert(ClusterChannels::size <= 256,
+              "Too many channels for PairRandom");
+// Mixed events only form clusters from two different species
+static_assert(!DeuteronChannel::same_type,
+              "Mixed events pair particles of different types");
+}  // unnamed namespace
+
 Coalescence::Coalescence(const std::string output_file,
   double deuteron_deltap, double deuteron_deltar,
-  bool probabilistic) :
+  bool probabilistic, uint64_t seed,
+  OutputFormat output_format, bool compress_output,
+  uint64_t resume_output_size) :
+    seed_(seed),
+    simd_level_(best_simd_level()),
     deuteron_deltap_(deuteron_deltap),
     deuteron_deltar_(deuteron_deltar),
     probabilistic_(probabilistic) {
-  output_ = std::fopen(output_file.c_str(), "w");
-  if (output_ == NULL) {
-    throw std::runtime_error("Can't open file " + output_file);
-  }
-  // Initialize random number generator
-  rng_generator_.seed(this->random_device_());
-  for (int i = 0; i < y_nbins_; i++) {
-    proton_y_[i] = 0.0;
-    deuteron_y_[i] = 0.0;
-    triton_y_[i] = 0.0;
-  }
-}
-
-Coalescence::~Coalescence() {
-  std::fclose(output_);
-}
-
-ParticleType Coalescence::pdg_to_type(int32_t pdg) {
-  switch (pdg) {
-    case 2212:  return ParticleType::p;
-    case 2112:  return ParticleType::n;
-    case 3122:  return ParticleType::la;
-    case 3212:  return ParticleType::sig0;
-    case -2212: return ParticleType::ap;
-    case -2112: return ParticleType::an;
-    case -3122: return ParticleType::ala;
-    case -3212:  return ParticleType::asig0;
-    default: return ParticleType::boring;
-  };
+  output_.reset(new AsyncNucleiWriter(
+      NucleiWriter::create(output_file, output_format, compress_output,
+                           resume_output_size),
+      output_queue_size));
+  // The cut type is fixed for the run, so the event loops are chosen once
+  if (probabilistic_) {
+    process_events_ = &Coalescence::process_events<CutType::wigner>;
+    process_mixed_events_ =
+        &Coalescence::process_mixed_events<CutType::wigner>;
+  } else {
+    process_events_ = &Coalescence::process_events<CutType::sharp>;
+    process_mixed_events_ =
+        &Coalescence::process_mixed_events<CutType::sharp>;
+  }
+  // Rapidity distributions of p, d and t printed by print_histograms
+  for (ParticleType type : {ParticleType::p, ParticleType::d,
+                            ParticleType::t}) {
+    histograms_.add(Histogram(type, {{HistogramVariable::rapidity,
+                                      -4.0, 4.0, 41}}));
+  }
 }
 
-void Coalescence::make_nuclei(const std::string &input_file) {
+Coalescence::~Coalescence() {}
+
+void Coalescence::make_nuclei(const std::string &input_file,
+                              size_t file_index, size_t first_event) {
   /*
-   *  1. Read event
-   *  2. Perform coalescence over particles from the event
-   *  3. Write results to output
+   *  1. Read a batch of events
+   *  2. Perform coalescence over particles from each event, events of the
+   *     batch are processed in parallel
+   *  3. Write results to output in the order of events
    *  4. Repeat until the input file is over
    */
-  FILE* input = std::fopen(input_file.c_str(), "rb");
-  if (input == NULL) {
-    throw std::runtime_error("Can't open file " + input_file);
+  if (first_event > 0 && mixing_window_ > 1) {
+    throw std::invalid_argument("Mixed events can't start within a file");
   }
-
-  // Read header
-  char magic_number[5], smash_version[20];
-  uint16_t format_version, format_variant;
-  uint32_t len;
-  std::fread(&magic_number[0], 4, 1, input);
-  magic_number[4] = '\x00';
-  std::fread(&format_version, sizeof(std::uint16_t), 1, input);
-  // std::cout << "SMASH output version " << format_version << std::endl;
-  std::fread(&format_variant, sizeof(std::uint16_t), 1, input);
-  std::fread(&len, sizeof(std::uint32_t), 1, input);
-  std::fread(&smash_version[0], sizeof(char), len, input);
-
-  if (strcmp(magic_number, "SMSH") != 0) {
-    std::cout << "Magic number = " << magic_number << std::endl;
-    throw std::runtime_error(input_file + " is likely not a SMASH binary:" +
-                             " magic number does not match ");
+  SmashBinaryReader reader(input_file);
+#ifdef _OPENMP
+  // Files may already be processed in parallel, then events are not
+  const size_t batch_size = omp_in_parallel() ? 1 : 4 * omp_get_max_threads();
+#else
+  const size_t batch_size = 1;
+#endif
+  std::vector<EventBuffer> &events = events_;
+  if (events.size() < batch_size) {
+    events.resize(batch_size);
   }
-
-  if (format_variant != 1) {
-    throw std::runtime_error(input_file + " is not a file of" +
-                             " extended SMASH binary format.");
+  // Events read, and how many of them have seen the end of the event
+  size_t n_ready = 0, n_closed = 0;
+#ifdef _OPENMP
+  const size_t n_threads = omp_get_max_threads();
+#else
+  const size_t n_threads = 1;
+#endif
+  if (arenas_.size() < n_threads) {
+    arenas_.resize(n_threads);
   }
+  const size_t n_events_before = n_arena_events(),
+               n_allocations_before = n_arena_allocations();
+  // Mixed events are kept in a ring, which holds the window before the
+  // batch and the batch itself
+  std::vector<MixingSlot> &ring = mixing_ring_;
+  ring.resize(mixing_window_ > 1 ? mixing_window_ - 1 + batch_size : 0);
+  size_t n_mixed = 0;
+  // Events of the file, which have ended so far
+  size_t n_file_events = 0;
+  // An event may have several particle blocks, so more than a batch can
+  // be waiting, it is then processed in pieces of the batch size
+  auto process_batch = [&]() {
+    for (size_t first = 0; first < n_ready; first += batch_size) {
+      const size_t n = std::min(batch_size, n_ready - first);
+      if (mixing_window_ > 1) {
+        (this->*process_mixed_events_)(&events[first], n, ring, n_mixed);
+        n_mixed += n;
+      } else {
+        (this->*process_events_)(&events[first], n, file_index);
+      }
+    }
+    reserve_buffers();
+    n_ready = 0;
+    n_closed = 0;
+  };
 
-  // std::cout << magic_number << " " << format_version << " "
-  //           << format_variant << " " << smash_version << std::endl;
-
-  std::vector<Particle> hadrons, nuclei;
-  hadrons.clear();
-  nuclei.clear();
- 
   while (true) {
-    char block_type;
-    if (!std::fread(&block_type, sizeof(char), 1, input)) {
+    if (n_ready == events.size()) {
+      events.emplace_back();
+    }
+    EventBuffer &event = events[n_ready];
+    SmashBinaryReader::Block block;
+    {
+      ScopedStageTimer timer(RunStage::read);
+      const size_t capacity_before = event.hadrons.capacity();
+      block = reader.read_block(event.hadrons);
+      event.grown = event.grown ||
+                    event.hadrons.capacity() > capacity_before;
+    }
+    if (block == SmashBinaryReader::Block::end_of_input) {
       break;
     }
-    if (block_type == 'f') {
-      uint32_t ev;
-      double impact_parameter;
-      char empty;
-      std::fread(&ev, sizeof(std::uint32_t), 1, input);
-      std::fread(&impact_parameter, sizeof(double), 1, input);
-      if (format_version > 6) {
-        std::fread(&empty, sizeof(char), 1, input);
+    if (n_file_events < first_event) {
+      // Done before the checkpoint, counted in its histograms already
+      event.hadrons.clear();
+      if (block == SmashBinaryReader::Block::event_end) {
+        n_file_events++;
       }
+      continue;
+    }
+    if (block == SmashBinaryReader::Block::event_end) {
+      // Blocks are processed once the impact parameter is known
+      for (; n_closed < n_ready; n_closed++) {
+        events[n_closed].impact_parameter = reader.impact_parameter();
+      }
+      histograms_.add_event(reader.impact_parameter());
       event_number_++;
+      n_file_events++;
+      if (n_ready >= batch_size) {
+        process_batch();
+        if (!checkpoint_file_.empty() && mixing_window_ == 1 &&
+            std::chrono::steady_clock::now() - last_checkpoint_ >=
+                checkpoint_interval_) {
+          write_checkpoint(file_index, n_file_events);
+        }
+      }
       continue;
     }
-    if (block_type != 'p') {
-      break;
+
+    if (mixing_window_ > 1 && n_ready > n_closed) {
+      // Blocks of one event would be mixed with each other like events
+      throw std::runtime_error(input_file + " has an event with several " +
+                               "particle blocks, which can't be mixed.");
+    }
+    event.event_number = event_number_;
+    event.impact_parameter = std::numeric_limits<double>::quiet_NaN();
+    n_ready++;
+  }
+  process_batch();
+  count(RunCounter::particles_read, reader.n_kept() + reader.n_skipped());
+  if (!checkpoint_file_.empty()) {
+    write_checkpoint(file_index + 1, 0);
+  }
+  // One write, so that lines from files processed in parallel do not mix
+  std::cout << input_file + ": kept " + std::to_string(reader.n_kept()) +
+               " particles, skipped " + std::to_string(reader.n_skipped()) +
+               ", buffers grew in " +
+               std::to_string(n_arena_allocations() - n_allocations_before) +
+               " of " + std::to_string(n_arena_events() - n_events_before) +
+               " events\n" << std::flush;
+}
+
+template <CutType Cut>
+void Coalescence::process_events(EventBuffer *events,
+                                 size_t n_events, size_t file_index) {
+  // All the physics of coalescence happens inside
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < n_events; i++) {
+    EventBuffer &event = events[i];
+    EventArena &arena = thread_arena();
+    const size_t memory_before = arena.memory_size(),
+                 nuclei_before = event.nuclei.capacity();
+    if (Cut == CutType::sharp) {
+      coalesce(event.hadrons, event.nuclei,
+               event_random(file_index, event.event_number), arena);
+    } else {
+      coalesce_probabilistic(event.hadrons, event.nuclei, arena);
+    }
+    arena.n_events++;
+    if (arena.memory_size() > memory_before ||
+        event.nuclei.capacity() > nuclei_before || event.grown) {
+      arena.n_grown++;
     }
-    uint32_t n_part_lines;
-    std::fread(&n_part_lines, sizeof(std::uint32_t), 1, input);
-    for (size_t i = 0; i < n_part_lines; i++) {
-      double t, x, y, z, m, p0, px, py, pz,
-             form_time, xsecfac, time_last_coll;
-      int32_t pdg, id, charge, ncoll, proc_id_origin,
-              proc_type_origin, pdg_mother1, pdg_mother2;
-      std::fread(&t, sizeof(double), 1, input);
-      std::fread(&x, sizeof(double), 1, input);
-      std::fread(&y, sizeof(double), 1, input);
-      std::fread(&z, sizeof(double), 1, input);
-      std::fread(&m, sizeof(double), 1, input);
-      std::fread(&p0, sizeof(double), 1, input);
-      std::fread(&px, sizeof(double), 1, input);
-      std::fread(&py, sizeof(double), 1, input);
-      std::fread(&pz, sizeof(double), 1, input);
-      std::fread(&pdg, sizeof(std::int32_t), 1, input);
-      std::fread(&id,  sizeof(std::int32_t), 1, input);
-      std::fread(&charge, sizeof(std::int32_t), 1, input);
-      std::fread(&ncoll,  sizeof(std::int32_t), 1, input);
-      std::fread(&form_time, sizeof(double), 1, input);
-      std::fread(&xsecfac, sizeof(double), 1, input);
-      std::fread(&proc_id_origin, sizeof(std::int32_t), 1, input);
-      std::fread(&proc_type_origin, sizeof(std::int32_t), 1, input);
-      std::fread(&time_last_coll, sizeof(double), 1, input);
-      std::fread(&pdg_mother1, sizeof(std::int32_t), 1, input);
-      std::fread(&pdg_mother2, sizeof(std::int32_t), 1, input);
-
-      ParticleType hadron_type = pdg_to_type(pdg);
-      if (hadron_type != ParticleType::boring) {
-        FourVector r(t, x, y, z), p(p0, px, py, pz);
-        FourVector origin(time_last_coll,
-            r.threevec() - (t - time_last_coll) * p.velocity());
-        hadrons.push_back({p, origin, hadron_type,
-                           pdg_mother1, pdg_mother2, 1.0, true});
-        // std::cout << pdg << " " << static_cast<int>(hadron_type) << " "
-        //          << r << " " << p << " " << origin << std::endl;
+    count(RunCounter::events);
+  }
+  finish_events(events, n_events);
+}
+
+template <CutType Cut>
+void Coalescence::process_mixed_events(EventBuffer *events,
+                                       size_t n_events,
+                                       std::vector<MixingSlot> &ring,
+                                       size_t n_mixed) {
+  const size_t n_slots = ring.size();
+  const double deltap = Cut == CutType::wigner ? 2.0 * max_wigner_q()
+                                               : deuteron_deltap_;
+  // 1. Nucleons of the new events replace the ones of the oldest events,
+  //    which have left the window
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < n_events; i++) {
+    MixingSlot &slot = ring[(n_mixed + i) % n_slots];
+    const size_t memory_before = slot.nucleons.capacity() * sizeof(Particle) +
+                                 slot.grid.memory_size();
+    {
+      ScopedStageTimer timer(RunStage::filter);
+      slot.nucleons.clear();
+      for (const Particle &hadron : events[i].hadrons) {
+        if (!is_spectator(hadron) && (hadron.type == DeuteronChannel::a ||
+                                      hadron.type == DeuteronChannel::b)) {
+          slot.nucleons.push_back(hadron);
+        }
       }
+      count(RunCounter::nucleons_kept, slot.nucleons.size());
+    }
+    ScopedStageTimer timer(RunStage::pair_search);
+    const double m_min = MomentumGrid::min_mass(slot.nucleons);
+    slot.grid.build(slot.nucleons,
+                    MomentumGrid::max_distance(m_min, m_min, deltap));
+    if (slot.nucleons.capacity() * sizeof(Particle) +
+        slot.grid.memory_size() > memory_before) {
+      events[i].grown = true;
     }
-    // std::cout << "Read in " << n_part_lines << " particles" << std::endl;
+  }
 
-    // All the physics of coalescence happens inside
-    if (event_number_ % n_events_combined_ == 0) {
-      if (!probabilistic_) {
-        coalesce(hadrons, nuclei);
-      } else {
-        coalesce_probabilistic(hadrons, nuclei);
+  // 2. Look up the nucleons of each earlier event of the window on the grid
+  //    of the new event. Only the grid of the new event is modified, so
+  //    events are independent.
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < n_events; i++) {
+    const size_t current = n_mixed + i;
+    const size_t first = current >= mixing_window_ - 1 ?
+                         current - (mixing_window_ - 1) : 0;
+    EventArena &arena = thread_arena();
+    const size_t memory_before = arena.memory_size(),
+                 nuclei_before = events[i].nuclei.capacity();
+    events[i].nuclei.clear();
+    for (size_t partner = first; partner < current; partner++) {
+      mix_events<Cut, DeuteronChannel>(ring[current % n_slots],
+                                       ring[partner % n_slots],
+                                       1.0 / (current - first),
+                                       events[i].nuclei, arena);
+    }
+    arena.n_events++;
+    if (arena.memory_size() > memory_before ||
+        events[i].nuclei.capacity() > nuclei_before || events[i].grown) {
+      arena.n_grown++;
+    }
+    count(RunCounter::events);
+  }
+  finish_events(events, n_events);
+}
+
+template <CutType Cut, typename Channel>
+void Coalescence::mix_events(MixingSlot &event, const MixingSlot &partner,
+                             double weight_factor,
+                             std::vector<Particle> &nuclei,
+                             EventArena &arena) const {
+  std::vector<size_t> &candidates = arena.candidates;
+  std::vector<uint32_t> &positions = arena.positions;
+  std::vector<double> &weights = arena.weights;
+  const size_t n_nuclei_before = nuclei.size();
+  for (const Particle &nucleon : partner.nucleons) {
+    if (Cut == CutType::sharp) {
+      // No random acceptance and no removal of used nucleons, every pair
+      // of the two species within the cuts counts with its probability
+      {
+        ScopedStageTimer timer(RunStage::pair_search);
+        event.grid.find_candidates(nucleon.momentum, deuteron_deltap_,
+                                   candidates);
       }
-      // Print out nuclei
-      fprintf(output_, "# event %lu %lu\n", event_number_, nuclei.size());
-      for (const Particle &nucleus : nuclei) {
-        const FourVector &p = nucleus.momentum;
-        add_to_histograms(nucleus);
-        fprintf(output_, "%12.8f %12.8f %12.8f %12.8f %d %12.8f\n",
-            p.x0(), p.x1(), p.x2(), p.x3(), static_cast<int>(nucleus.type), nucleus.weight);
+      ScopedStageTimer timer(RunStage::nuclei);
+      for (size_t j : candidates) {
+        const Particle &other = event.nucleons[j];
+        if (other.type == nucleon.type ||
+            !check_vicinity(other, nucleon, deuteron_deltap_,
+                            deuteron_deltar_)) {
+          continue;
+        }
+        const Particle &a = (other.type == Channel::a) ? other : nucleon;
+        const Particle &b = (other.type == Channel::a) ? nucleon : other;
+        nuclei.push_back(make_particle(
+            a.momentum + b.momentum, combined_r(a, b), Channel::product,
+            type_to_pdg(Channel::a), type_to_pdg(Channel::b),
+            Channel::probability * weight_factor));
       }
-      for (const Particle &hadron : hadrons) {
-        add_to_histograms(hadron);
+    } else {
+      {
+        ScopedStageTimer timer(RunStage::pair_search);
+        event.grid.find_candidates(nucleon.momentum, 2.0 * max_wigner_q(),
+                                   candidates);
       }
-      hadrons.clear();
-      nuclei.clear();
+      ScopedStageTimer timer(RunStage::nuclei);
+      count(RunCounter::pairs_tested, candidates.size());
+      positions.clear();
+      for (size_t j : candidates) {
+        positions.push_back(event.grid.position(j));
+      }
+      weights.resize(positions.size());
+      pair_weights(simd_level_, nucleon.momentum, nucleon.origin,
+                   event.grid.nucleons(), positions.data(), positions.size(),
+                   wigner_d2, hbarc, weights.data());
+      for (size_t k = 0; k < positions.size(); k++) {
+        if (weights[k] < weight_cutoff) {
+          continue;
+        }
+        const Particle &other = event.nucleons[candidates[k]];
+        nuclei.push_back(make_particle(
+            other.momentum + nucleon.momentum, combined_r(other, nucleon),
+            Channel::product, static_cast<int>(other.type),
+            static_cast<int>(nucleon.type), weights[k] * weight_factor));
+      }
+    }
+  }
+  count(RunCounter::nuclei_produced, nuclei.size() - n_nuclei_before);
+}
+
+Coalescence::EventArena &Coalescence::thread_arena() {
+#ifdef _OPENMP
+  return arenas_[omp_get_thread_num()];
+#else
+  return arenas_[0];
+#endif
+}
+
+size_t Coalescence::EventArena::memory_size() const {
+  size_t n_particles = nucleons.capacity();
+  size_t finder_bytes = 0;
+  for (size_t type = 0; type < n_particle_types; type++) {
+    n_particles += clusters[type].capacity();
+    finder_bytes += cluster_finders[type].memory_size();
+  }
+  return n_particles * sizeof(Particle) + finder_bytes +
+         grid.memory_size() +
+         candidates.capacity() * sizeof(size_t) +
+         positions.capacity() * sizeof(uint32_t) +
+         weights.capacity() * sizeof(double);
+}
+
+void Coalescence::EventArena::reserve_like(const EventArena &other,
+                                           double factor) {
+  for (size_t type = 0; type < n_particle_types; type++) {
+    clusters[type].reserve(
+        scaled_capacity(other.clusters[type].capacity(), factor));
+    cluster_finders[type].reserve_like(other.cluster_finders[type], factor);
+  }
+  nucleons.reserve(scaled_capacity(other.nucleons.capacity(), factor));
+  grid.reserve_like(other.grid, factor);
+  candidates.reserve(scaled_capacity(other.candidates.capacity(), factor));
+  positions.reserve(scaled_capacity(other.positions.capacity(), factor));
+  weights.reserve(scaled_capacity(other.weights.capacity(), factor));
+}
+
+size_t Coalescence::n_arena_events() const {
+  size_t n = 0;
+  for (const EventArena &arena : arenas_) {
+    n += arena.n_events;
+  }
+  return n;
+}
+
+size_t Coalescence::n_arena_allocations() const {
+  size_t n = 0;
+  for (const EventArena &arena : arenas_) {
+    n += arena.n_grown;
+  }
+  return n;
+}
+
+void Coalescence::fill_histograms(const EventBuffer &event) {
+  ScopedStageTimer timer(RunStage::histograms);
+  for (const Particle &nucleus : event.nuclei) {
+    histograms_.fill(nucleus, event.impact_parameter);
+  }
+  for (const Particle &hadron : event.hadrons) {
+    histograms_.fill(hadron, event.impact_parameter);
+  }
+}
+
+void Coalescence::finish_events(EventBuffer *events, size_t n_events) {
+  for (size_t i = 0; i < n_events; i++) {
+    EventBuffer &event = events[i];
+    // Weights are summed in the order of events, so that the histograms
+    // do not depend on the number of threads
+    fill_histograms(event);
+    max_nuclei_ = std::max(max_nuclei_, event.nuclei.capacity());
+    {
+      // Hand the nuclei over to the writer thread
+      ScopedStageTimer timer(RunStage::output);
+      output_->write_event(event.event_number, event.nuclei);
     }
+    event.hadrons.clear();
+    event.nuclei.clear();
+    event.grown = false;
   }
-  // std::cout << event_number_ << " events" <<  std::endl;
-  std::fclose(input);
+}
+
+void Coalescence::reserve_buffers() {
+  // The first batch shows the sizes of typical events, larger ones only
+  // need more memory if they are more than twice as large
+  const double factor = buffers_reserved_ ? 1.0 : 2.0;
+  buffers_reserved_ = true;
+  // Largest memory of each buffer of an arena, then the same in all
+  for (size_t t = 1; t < arenas_.size(); t++) {
+    arenas_[0].reserve_like(arenas_[t]);
+  }
+  arenas_[0].reserve_like(arenas_[0], factor);
+  for (size_t t = 1; t < arenas_.size(); t++) {
+    arenas_[t].reserve_like(arenas_[0]);
+  }
+  for (size_t k = 1; k < mixing_ring_.size(); k++) {
+    mixing_ring_[0].nucleons.reserve(mixing_ring_[k].nucleons.capacity());
+    mixing_ring_[0].grid.reserve_like(mixing_ring_[k].grid);
+  }
+  if (!mixing_ring_.empty()) {
+    mixing_ring_[0].nucleons.reserve(
+        scaled_capacity(mixing_ring_[0].nucleons.capacity(), factor));
+    mixing_ring_[0].grid.reserve_like(mixing_ring_[0].grid, factor);
+  }
+  for (size_t k = 1; k < mixing_ring_.size(); k++) {
+    mixing_ring_[k].nucleons.reserve(mixing_ring_[0].nucleons.capacity());
+    mixing_ring_[k].grid.reserve_like(mixing_ring_[0].grid);
+  }
+  // Nuclei buffers move between the events and the writer slots
+  size_t max_hadrons = 0;
+  for (const EventBuffer &event : events_) {
+    max_hadrons = std::max(max_hadrons, event.hadrons.capacity());
+  }
+  max_hadrons = scaled_capacity(max_hadrons, factor);
+  max_nuclei_ = scaled_capacity(max_nuclei_, factor);
+  for (EventBuffer &event : events_) {
+    event.hadrons.reserve(max_hadrons);
+    event.nuclei.reserve(max_nuclei_);
+  }
+  output_->reserve(max_nuclei_);
+}
+
+bool Coalescence::is_spectator(const Particle &hadron) {
+  // Avoid spectator nucleons. Even if fragmentation of spectators occurs
+  // the corresponding nucleons should collide with something.
+  // Be careful not to reject nucleons born from hydro, that also have
+  // pdg_mother == 0.
+  return hadron.pdg_mother1 == 0 && hadron.pdg_mother2 == 0 &&
+         hadron.momentum.x1() == 0.0 && hadron.momentum.x2() == 0;
+}
+
+double Coalescence::max_wigner_q() {
+  // Only pairs, where the momentum part of the Wigner function alone
+  // does not push the weight below the cutoff, can contribute.
+  return std::sqrt(std::log(3.0 / weight_cutoff)) * hbarc /
+         std::sqrt(wigner_d2);
+}
+
+double Coalescence::cm_momentum_difference_sqr(const FourVector &p1,
+                                               const FourVector &p2) {
+  // |p1* - p2*|^2 = 4 k^2 = lambda(s, m1^2, m2^2) / s, where k is the
+  // momentum of either particle in the center of mass frame
+  const double s = (p1 + p2).sqr();
+  const double m1sqr = p1.sqr(), m2sqr = p2.sqr();
+  const double a = s - m1sqr - m2sqr;
+  return (a * a - 4.0 * m1sqr * m2sqr) / s;
+}
+
+double Coalescence::cm_momentum_difference_sqr(const Particle &h1,
+                                               const Particle &h2) {
+  const double s = (h1.momentum + h2.momentum).sqr();
+  const double m1sqr = h1.kin.mass * h1.kin.mass,
+               m2sqr = h2.kin.mass * h2.kin.mass;
+  const double a = s - m1sqr - m2sqr;
+  return (a * a - 4.0 * m1sqr * m2sqr) / s;
 }
 
 bool Coalescence::check_vicinity(const Particle &h1,
                                  const Particle &h2,
                                  double deltap,
-                                 double deltar) {
+                                 double deltar) const {
+  // 0. Check if any of these particles was already coalesced earlier
+  if (!h1.valid || !h2.valid) {
+    return false;
+  }
+
+  count(RunCounter::pairs_tested);
+
+  // 1. Reject pairs with too large momentum difference before boosting,
+  //    the difference in the center of mass frame is Lorentz-invariant
+  if (cm_momentum_difference_sqr(h1, h2) >
+      deltap * deltap * (1.0 + invariant_tolerance)) {
+    return false;
+  }
+
   // const double deltar = 2.0 * M_PI * hbarc / deltap;
   FourVector x1(h1.origin), x2(h2.origin),
              p1(h1.momentum), p2(h2.momentum);
-  // 1. Boost to the center of mass frame
+  // 2. Boost to the center of mass frame
   const ThreeVector vcm = (p1 + p2).velocity();
   p1 = p1.lorentz_boost(vcm);
   p2 = p2.lorentz_boost(vcm);
@@ -194,31 +560,38 @@ bool Coalescence::check_vicinity(const Particle &h1,
               << p1 + p2 << std::endl;
   }
 
-  // 2. Check if momentum difference is too large
+  // 3. Check if momentum difference is too large
   if ((p1.threevec() - p2.threevec()).abs() > deltap) {
     return false;
   }
+  count(RunCounter::pairs_momentum_cut);
 
-  // 3. Roll to the time, when the last hadron was born
+  // 4. Roll to the time, when the last hadron was born
   const double tmax = std::max({x1.x0(), x2.x0()});
   ThreeVector r1 = x1.threevec() + (tmax - x1.x0()) * p1.velocity(),
               r2 = x2.threevec() + (tmax - x2.x0()) * p2.velocity();
 
-  // 4. Check if spatial distance is too large
+  // 5. Check if spatial distance is too large
   if ((r1 - r2).abs() > deltar) {
     return false;
   }
-
-  // 5. Check if any of these particles was already coalesced earlier
-  if (!h1.valid || !h2.valid) {
-    return false;
-  }
+  count(RunCounter::pairs_spatial_cut);
 
   return true;
 }
 
 double Coalescence::get_pair_weight(const Particle &h1,
-                                  const Particle &h2) {
+                                  const Particle &h2) const {
+  constexpr double d2 = wigner_d2;
+  // 0. The momentum part of the Wigner function alone may already bring
+  //    the weight below the cutoff, this is known without boosting
+  const double dp2_invariant =
+      0.25 * cm_momentum_difference_sqr(h1, h2);
+  if (dp2_invariant * d2 / (hbarc * hbarc) >
+      std::log(3.0 / weight_cutoff) * (1.0 + invariant_tolerance)) {
+    return 0.0;
+  }
+
   FourVector x1(h1.origin), x2(h2.origin),
              p1(h1.momentum), p2(h2.momentum);
   // 1. Boost to the center of mass frame
@@ -243,190 +616,277 @@ double Coalescence::get_pair_weight(const Particle &h1,
   // 4. Get spatial distance
   const double dr2 = (r1 - r2).sqr();
 
-  constexpr double d2 = 3.2 * 3.2;  // [fm^2], see 2012.04352
   return 3.0 * std::exp(- dr2 / d2 - dp2 * d2 / (hbarc * hbarc));
 }
 
 
 FourVector Coalescence::combined_r(const Particle &h1, const Particle &h2) {
-  FourVector x1(h1.origin), x2(h2.origin),
-             p1(h1.momentum), p2(h2.momentum);
+  const FourVector &x1 = h1.origin, &x2 = h2.origin;
   const double tmax = std::max({x1.x0(), x2.x0()});
-  ThreeVector r1 = x1.threevec() + (tmax - x1.x0()) * p1.velocity(),
-              r2 = x2.threevec() + (tmax - x2.x0()) * p2.velocity();
+  ThreeVector r1 = x1.threevec() + (tmax - x1.x0()) * h1.kin.velocity,
+              r2 = x2.threevec() + (tmax - x2.x0()) * h2.kin.velocity;
   return FourVector(tmax, 0.5 * (r1 + r2));
 }
 
 void Coalescence::coalesce_probabilistic(const std::vector<Particle> &hadrons,
-                           std::vector<Particle> &nuclei) {
+                           std::vector<Particle> &nuclei) const {
+  EventArena arena;
+  coalesce_probabilistic(hadrons, nuclei, arena);
+}
+
+void Coalescence::coalesce_probabilistic(const std::vector<Particle> &hadrons,
+                           std::vector<Particle> &nuclei,
+                           EventArena &arena) const {
   nuclei.clear();
-  std::vector<Particle> nucleons;
+  std::vector<Particle> &nucleons = arena.nucleons;
   nucleons.clear();
 
-  for (const Particle &hadron : hadrons) {
-    // Avoid spectator nucleons. Even if fragmentation of spectators occurs
-    // the corresponding nucleons should collide with something.
-    // Be careful not to reject nucleons born from hydro, that also have
-    // pdg_mother == 0.
-    if (hadron.pdg_mother1 == 0 && hadron.pdg_mother2 == 0 &&
-        hadron.momentum.x1() == 0.0 && hadron.momentum.x2() == 0) {
-      continue;
-    }
+  {
+    ScopedStageTimer timer(RunStage::filter);
+    for (const Particle &hadron : hadrons) {
+      if (is_spectator(hadron)) {
+        continue;
+      }
 
-    switch (hadron.type) {
-      case ParticleType::p: nucleons.push_back(hadron); break;
-      case ParticleType::n: nucleons.push_back(hadron); break;
-      default: ;
+      switch (hadron.type) {
+        case ParticleType::p: nucleons.push_back(hadron); break;
+        case ParticleType::n: nucleons.push_back(hadron); break;
+        default: ;
+      }
     }
+    count(RunCounter::nucleons_kept, nucleons.size());
   }
   // std::cout << "Trying to combine " << protons.size() << " protons and "
   //          << neutrons.size() << " neutrons into deuterons." << std::endl;
+  const double max_q = max_wigner_q();
+  const double m_min = MomentumGrid::min_mass(nucleons);
+  const double dx = MomentumGrid::max_distance(m_min, m_min, 2.0 * max_q);
+  MomentumGrid &grid = arena.grid;
+  {
+    ScopedStageTimer timer(RunStage::pair_search);
+    grid.build(nucleons, dx);
+  }
+  std::vector<size_t> &candidates = arena.candidates;
+  std::vector<uint32_t> &positions = arena.positions;
+  std::vector<double> &weights = arena.weights;
   size_t N = nucleons.size();
   for (size_t i = 0; i < N; i++) {
-    for (size_t j = 0; j < i; j++) {
-      const double w = get_pair_weight(nucleons[i], nucleons[j]);
-      if (w < 1e-6) {
+    {
+      ScopedStageTimer timer(RunStage::pair_search);
+      grid.find_candidates(nucleons[i].momentum, 2.0 * max_q, candidates);
+    }
+    ScopedStageTimer timer(RunStage::nuclei);
+    positions.clear();
+    for (size_t j : candidates) {
+      if (j >= i) {
+        break;
+      }
+      positions.push_back(grid.position(j));
+    }
+    // Weights of all partners of nucleon i at once
+    count(RunCounter::pairs_tested, positions.size());
+    weights.resize(positions.size());
+    pair_weights(simd_level_, nucleons[i].momentum, nucleons[i].origin,
+                 grid.nucleons(), positions.data(), positions.size(),
+                 wigner_d2, hbarc, weights.data());
+    for (size_t k = 0; k < positions.size(); k++) {
+      const size_t j = candidates[k];
+      const double w = weights[k];
+      if (w < weight_cutoff) {
         continue;
       }
-      nuclei.push_back({nucleons[i].momentum + nucleons[j].momentum,
-                        combined_r(nucleons[i], nucleons[j]),
-                        ParticleType::d, static_cast<int>(nucleons[i].type),
-                        static_cast<int>(nucleons[j].type), w, true});
+      nuclei.push_back(make_particle(
+          nucleons[i].momentum + nucleons[j].momentum,
+          combined_r(nucleons[i], nucleons[j]), ParticleType::d,
+          static_cast<int>(nucleons[i].type),
+          static_cast<int>(nucleons[j].type), w));
     }
   }
-
-
+  count(RunCounter::nuclei_produced, nuclei.size());
 }
 
-void Coalescence::coalesce(const std::vector<Particle> &hadrons,
-                           std::vector<Particle> &nuclei) {
-  std::uniform_real_distribution<double> uniform01(0.0, 1.0);
-  nuclei.clear();
-  std::vector<Particle> protons, neutrons, antiprotons, antineutrons;
-  for (const Particle &hadron : hadrons) {
-    // Avoid spectator nucleons. Even if fragmentation of spectators occurs
-    // the corresponding nucleons should collide with something.
-    // Be careful not to reject nucleons born from hydro, that also have
-    // pdg_mother == 0.
-    if (hadron.pdg_mother1 == 0 && hadron.pdg_mother2 == 0 &&
-        hadron.momentum.x1() == 0.0 && hadron.momentum.x2() == 0) {
-      continue;
-    }
-
-    switch (hadron.type) {
-      case ParticleType::p: protons.push_back(hadron); break;
-      case ParticleType::n: neutrons.push_back(hadron); break;
-      case ParticleType::ap: antiprotons.push_back(hadron); break;
-      case ParticleType::an: antineutrons.push_back(hadron); break;
-      default: ;
-    }
+struct Coalescence::ChannelPass {
+  const Coalescence &coalescence;
+  const PairRandom &random;
+  EventArena &arena;
+  std::array<bool, n_particle_types> &indexed;
+  std::vector<Particle> &nuclei;
+
+  template <typename Channel>
+  void apply(size_t index) {
+    coalescence.coalesce_channel<Channel>(index, random, arena, indexed,
+                                          nuclei);
   }
-  // std::cout << "Trying to combine " << protons.size() << " protons and "
-  //          << neutrons.size() << " neutrons into deuterons." << std::endl;
-  for (Particle &proton : protons) {
-    for (Particle &neutron : neutrons) {
-      // Spin average over initial states (* 1/4),
-      // spin sum over final state (* 3), and
-      // isospin projection (* 1/2), see DOI: 10.1103/PhysRevC.53.367
-      // Therfore accept with probability 3/8.
-      if (uniform01(rng_generator_) < 3./8. &&
-          check_vicinity(proton, neutron, deuteron_deltap_, deuteron_deltar_)) { /*
-        std::cout << "Combining " << proton.momentum << " "
-                                  << proton.origin << " "
-                                  << proton.pdg_mother1 << " "
-                                  << proton.pdg_mother2 << " and "
-                                  << neutron.momentum << " "
-                                  << neutron.origin << " "
-                                  << neutron.pdg_mother1 << " "
-                                  << neutron.pdg_mother2 << " " << std::endl;
-        */
-        proton.valid = false;
-        neutron.valid = false;
-        nuclei.push_back({proton.momentum + neutron.momentum,
-                          combined_r(proton, neutron),
-                          ParticleType::d, 2212, 2112, 1.0, true});
-      }
-    }
+};
+
+template <typename Channel>
+void Coalescence::coalesce_channel(
+    size_t index, const PairRandom &random, EventArena &arena,
+    std::array<bool, n_particle_types> &indexed,
+    std::vector<Particle> &nuclei) const {
+  constexpr size_t ia = static_cast<size_t>(Channel::a),
+                   ib = static_cast<size_t>(Channel::b);
+  std::vector<size_t> &candidates = arena.candidates;
+  std::vector<Particle> &as = arena.clusters[ia], &bs = arena.clusters[ib];
+  PairFinder &finder = arena.cluster_finders[ib];
+  if (!indexed[ib]) {
+    ScopedStageTimer timer(RunStage::pair_search);
+    finder.build(bs, deuteron_deltap_, pair_search_);
+    indexed[ib] = true;
   }
-
-  std::vector<Particle> deuterons;
-  for (const Particle &nucleus : nuclei) {
-    if (nucleus.type == ParticleType::d) {
-      deuterons.push_back(nucleus);
-    }
-  }
-
-  for (Particle &deuteron : deuterons) {
-    if (!deuteron.valid) {
+  for (size_t i = 0; i < as.size(); i++) {
+    Particle &a = as[i];
+    if (!a.valid) {
       continue;
     }
-    for (Particle &proton : protons) {
-      if (!proton.valid) {
+    {
+      ScopedStageTimer timer(RunStage::pair_search);
+      finder.find_candidates(a.momentum, deuteron_deltap_, candidates);
+    }
+    ScopedStageTimer timer(RunStage::nuclei);
+    for (size_t j : candidates) {
+      // Pairs of the same type are taken once
+      if (Channel::same_type && j <= i) {
         continue;
       }
-      if (uniform01(rng_generator_) < 1./4. &&
-        check_vicinity(deuteron, proton, deuteron_deltap_, deuteron_deltar_)) {
-        deuteron.valid = false;
-        proton.valid = false;
-        nuclei.push_back({proton.momentum + deuteron.momentum,
-                          combined_r(proton, deuteron),
-                          ParticleType::He3, 1000010020, 2212, 1.0, true});
+      Particle &b = bs[j];
+      if (!b.valid) {
+        continue;
+      }
+      // The kinematic cuts come first, the acceptance of the pair does
+      // not depend on whether it is drawn
+      if (check_vicinity(a, b, deuteron_deltap_, deuteron_deltar_) &&
+          random.uniform(static_cast<uint32_t>(index),
+                         static_cast<uint32_t>(i),
+                         static_cast<uint32_t>(j)) < Channel::probability) {
+        a.valid = false;
+        b.valid = false;
+        if (indexed[ia]) {
+          arena.cluster_finders[ia].invalidate(i);
+        }
+        finder.invalidate(j);
+        nuclei.push_back(make_particle(
+            a.momentum + b.momentum, combined_r(a, b), Channel::product,
+            type_to_pdg(Channel::a), type_to_pdg(Channel::b), 1.0));
+        arena.clusters[static_cast<size_t>(Channel::product)].push_back(
+            nuclei.back());
       }
     }
   }
+}
 
-  for (Particle &deuteron : deuterons) {
-    if (!deuteron.valid) {
-      continue;
+void Coalescence::coalesce(const std::vector<Particle> &hadrons,
+                           std::vector<Particle> &nuclei,
+                           const PairRandom &random) const {
+  EventArena arena;
+  coalesce(hadrons, nuclei, random, arena);
+}
+
+void Coalescence::coalesce(const std::vector<Particle> &hadrons,
+                           std::vector<Particle> &nuclei,
+                           const PairRandom &random,
+                           EventArena &arena) const {
+  nuclei.clear();
+  {
+    ScopedStageTimer timer(RunStage::filter);
+    for (std::vector<Particle> &particles : arena.clusters) {
+      particles.clear();
     }
-    for (Particle &neutron : neutrons) {
-      if (!neutron.valid) {
+    size_t n_kept = 0;
+    for (const Particle &hadron : hadrons) {
+      if (is_spectator(hadron) || hadron.type == ParticleType::boring) {
         continue;
       }
-      if (uniform01(rng_generator_) < 1./4. &&
-        check_vicinity(deuteron, neutron, deuteron_deltap_, deuteron_deltar_)) {
-        deuteron.valid = false;
-        neutron.valid = false;
-        nuclei.push_back({neutron.momentum + deuteron.momentum,
-                          combined_r(neutron, deuteron),
-                          ParticleType::t, 1000010020, 2112, 1.0, true});
-      }
+      arena.clusters[static_cast<size_t>(hadron.type)].push_back(hadron);
+      n_kept++;
     }
+    count(RunCounter::nucleons_kept, n_kept);
   }
 
+  // Partners are only tested if their momenta are close enough, which
+  // the finders tell without looking at all the pairs. The finder of a
+  // type is built when it is first searched, no channel after that may
+  // produce this type.
+  std::array<bool, n_particle_types> indexed;
+  indexed.fill(false);
+  ChannelPass pass{*this, random, arena, indexed, nuclei};
+  for_each_channel(ClusterChannels(), pass);
+  count(RunCounter::nuclei_produced, nuclei.size());
 }
 
-void Coalescence::add_to_histograms(const Particle &part) {
-  if (!part.valid) {
-    return;
+void Coalescence::add_histogram(const Histogram &histogram) {
+  histograms_.add(histogram);
+}
+
+void Coalescence::merge_histograms(const HistogramSet &other) {
+  histograms_.merge(other);
+}
+
+void Coalescence::append_output(const std::string &file) {
+  output_->flush();
+  output_->writer().append(file);
+}
+
+void Coalescence::flush_output() {
+  output_->flush();
+  output_->writer().flush();
+}
+
+void Coalescence::set_checkpoint(const std::string &file, double interval) {
+  checkpoint_file_ = file;
+  checkpoint_interval_ = std::chrono::duration_cast<
+      std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(interval));
+  last_checkpoint_ = std::chrono::steady_clock::now();
+}
+
+void Coalescence::write_checkpoint(size_t file_index, size_t events_done) {
+  output_->flush();
+  output_->writer().flush();
+  Checkpoint checkpoint;
+  checkpoint.seed = seed_;
+  checkpoint.event_number = event_number_;
+  checkpoint.file_index = file_index;
+  checkpoint.events_done = events_done;
+  checkpoint.output_size = output_->writer().size();
+  checkpoint.histograms = histograms_;
+  checkpoint.write(checkpoint_file_);
+  last_checkpoint_ = std::chrono::steady_clock::now();
+}
+
+void Coalescence::restore(const Checkpoint &checkpoint) {
+  if (checkpoint.seed != seed_) {
+    throw std::invalid_argument("The checkpoint has another seed");
   }
-  const FourVector p = part.momentum;
-  const double y = 0.5 * std::log((p[0] + p[3]) / (p[0] - p[3]));
-  const int i = std::floor((y - y_min_) / (y_max_ - y_min_) * y_nbins_);
-  if (part.type == ParticleType::p) {
-    proton_y_[i] += part.weight;
-  } else if (part.type == ParticleType::d) {
-    deuteron_y_[i] += part.weight;
-  } else if (part.type == ParticleType::t) {
-    triton_y_[i] += part.weight;
+  const HistogramSet &saved = checkpoint.histograms;
+  bool same = saved.size() == histograms_.size();
+  for (size_t i = 0; same && i < saved.size(); i++) {
+    same = saved[i].same_binning(histograms_[i]);
   }
+  if (!same) {
+    throw std::invalid_argument("The checkpoint has other histograms");
+  }
+  histograms_ = saved;
+  event_number_ = checkpoint.event_number;
 }
 
 void Coalescence::print_histograms() {
-  const double dy = (y_max_ - y_min_) / y_nbins_;
-  for (int i = 0; i < y_nbins_; i++) {
-    proton_y_[i]   /= (event_number_ * dy);
-    deuteron_y_[i] /= (event_number_ * dy);
-    triton_y_[i]   /= (event_number_ * dy);
-  }
+  const Histogram &protons = histograms_[0], &deuterons = histograms_[1],
+                  &tritons = histograms_[2];
+  const HistogramAxis &y_axis = protons.axes()[0];
+  const double norm = histograms_.n_events() * y_axis.width();
   printf("#y, dN/dy for p,d,t;  p*t/d^2\n");
-  for (int i = 0; i < y_nbins_; i++) {
-    const double y = y_min_ + (y_max_ - y_min_) / y_nbins_ * (i + 0.5);
+  for (int i = 0; i < y_axis.n_bins; i++) {
+    const std::array<int, 3> bin = {i, 0, 0};
+    const double proton_y = protons.value(bin) / norm,
+                 deuteron_y = deuterons.value(bin) / norm,
+                 triton_y = tritons.value(bin) / norm;
     double ptd2 = 0.0;
-    if (deuteron_y_[i] > 0.0) {
-      ptd2 = proton_y_[i] * triton_y_[i] / deuteron_y_[i] / deuteron_y_[i];
+    if (deuteron_y > 0.0) {
+      ptd2 = proton_y * triton_y / deuteron_y / deuteron_y;
     }
-    printf("%8.3f %10.1f %10.1f %10.1f %10.4f\n", y, proton_y_[i], deuteron_y_[i], triton_y_[i], ptd2);
+    printf("%8.3f %10.1f %10.1f %10.1f %10.4f\n", y_axis.center(i),
+           proton_y, deuteron_y, triton_y, ptd2);
   }
 }
 
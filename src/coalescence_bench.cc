@@ -0,0 +1,238 @@
+#include "coalescence/coalescence.h"
+#include "coalescence/nucleon_store.h"
+#include "coalescence/pair_weight_kernel.h"
+#include "coalescence/smash_binary_reader.h"
+#include "coalescence/synthetic_smash.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Timings of the hot parts of the coalescence on synthetic events, so that
+ * regressions are visible. Each benchmark runs for at least the minimal
+ * time given as the only argument (default: 0.2 s) and reports the time
+ * per call and the throughput in pairs or particles per second.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+// Sink for results, so that the benchmarked code is not optimized away
+volatile double sink = 0.0;
+
+/// Time per call of \p f, which is called until \p min_time seconds passed
+template <typename F>
+double seconds_per_call(double min_time, F &&f) {
+  typedef std::chrono::steady_clock clock;
+  size_t n_calls = 1;
+  while (true) {
+    const clock::time_point start = clock::now();
+    for (size_t i = 0; i < n_calls; i++) {
+      f();
+    }
+    const double elapsed =
+        std::chrono::duration<double>(clock::now() - start).count();
+    if (elapsed >= min_time) {
+      return elapsed / n_calls;
+    }
+    n_calls *= 2;
+  }
+}
+
+void report(const std::string &name, double seconds, double items,
+            const char *unit) {
+  std::printf("%-36s %12.1f us %12.3e %s/s\n", name.c_str(),
+              seconds * 1e6, items / seconds, unit);
+}
+
+}  // unnamed namespace
+
+int main(int argc, char **argv) {
+  const double min_time = argc > 1 ? std::stod(argv[1]) : 0.2;
+  const double deltap = 0.44;  // GeV
+  const double deltar = 2.0 * M_PI * 0.19732 / deltap;  // fm
+  // The nuclei found while benchmarking are not kept
+  Coalescence sharp("/dev/null", deltap, deltar, false, 42,
+                    OutputFormat::text, false);
+  Coalescence probabilistic("/dev/null", deltap, deltar, true, 42,
+                            OutputFormat::text, false);
+
+  // Single pairs, all pairs of 500 nucleons
+  const std::vector<Particle> nucleons =
+      SyntheticSmashGenerator::nucleons(500, 1);
+  const size_t n_pairs = nucleons.size() * (nucleons.size() - 1) / 2;
+  report("FourVector::lorentz_boost", seconds_per_call(min_time, [&]() {
+    double sum = 0.0;
+    for (size_t i = 0; i < nucleons.size(); i++) {
+      const ThreeVector &v = nucleons[(i + 1) % nucleons.size()].kin.velocity;
+      sum += nucleons[i].origin.lorentz_boost(v)[0];
+    }
+    sink = sum;
+  }), nucleons.size(), "boosts");
+  report("Coalescence::check_vicinity", seconds_per_call(min_time, [&]() {
+    size_t n_close = 0;
+    for (size_t i = 0; i < nucleons.size(); i++) {
+      for (size_t j = i + 1; j < nucleons.size(); j++) {
+        n_close += sharp.check_vicinity(nucleons[i], nucleons[j],
+                                        deltap, deltar);
+      }
+    }
+    sink = n_close;
+  }), n_pairs, "pairs");
+  report("Coalescence::get_pair_weight", seconds_per_call(min_time, [&]() {
+    double sum = 0.0;
+    for (size_t i = 0; i < nucleons.size(); i++) {
+      for (size_t j = i + 1; j < nucleons.size(); j++) {
+        sum += probabilistic.get_pair_weight(nucleons[i], nucleons[j]);
+      }
+    }
+    sink = sum;
+  }), n_pairs, "pairs");
+  report("Coalescence::combined_r", seconds_per_call(min_time, [&]() {
+    double sum = 0.0;
+    for (size_t i = 0; i < nucleons.size(); i++) {
+      for (size_t j = i + 1; j < nucleons.size(); j++) {
+        sum += Coalescence::combined_r(nucleons[i], nucleons[j])[0];
+      }
+    }
+    sink = sum;
+  }), n_pairs, "pairs");
+
+  // Batched weights with each instruction set, compared with the scalar
+  // get_pair_weight
+  NucleonStore store;
+  for (const Particle &nucleon : nucleons) {
+    store.push_back(nucleon);
+  }
+  std::vector<uint32_t> positions(nucleons.size());
+  std::iota(positions.begin(), positions.end(), 0);
+  std::vector<double> weights(nucleons.size());
+  constexpr double hbarc = 0.197327053, d2 = 3.2 * 3.2;
+  for (SimdLevel level : {SimdLevel::scalar, SimdLevel::avx2,
+                          SimdLevel::avx512}) {
+    if (level > best_simd_level()) {
+      continue;
+    }
+    double max_difference = 0.0;
+    for (size_t i = 0; i < nucleons.size(); i++) {
+      pair_weights(level, nucleons[i].momentum, nucleons[i].origin, store,
+                   positions.data(), positions.size(), d2, hbarc,
+                   weights.data());
+      // get_pair_weight gives 0 for pairs cut off before the exponent
+      for (size_t j = 0; j < nucleons.size(); j++) {
+        const double w = j != i ?
+            probabilistic.get_pair_weight(nucleons[i], nucleons[j]) : 0.0;
+        if (w > 0.0) {
+          max_difference = std::max(max_difference,
+                                    std::abs(weights[j] - w) / w);
+        }
+      }
+    }
+    const double seconds = seconds_per_call(min_time, [&]() {
+      double sum = 0.0;
+      for (size_t i = 0; i < nucleons.size(); i++) {
+        pair_weights(level, nucleons[i].momentum, nucleons[i].origin, store,
+                     positions.data(), positions.size(), d2, hbarc,
+                     weights.data());
+        sum += weights[0];
+      }
+      sink = sum;
+    });
+    report(std::string("pair_weights ") + simd_level_name(level), seconds,
+           nucleons.size() * nucleons.size(), "pairs");
+    std::printf("%-36s largest relative difference to get_pair_weight "
+                "%.3e\n", "", max_difference);
+  }
+
+  // Candidate selection in double and in single precision
+  for (bool single : {false, true}) {
+    AlignedVector<uint8_t> scratch;
+    std::vector<uint32_t> selected;
+    report(single ? "NucleonStore::prefilter_close_momenta"
+                  : "NucleonStore::select_close_momenta",
+           seconds_per_call(min_time, [&]() {
+      selected.clear();
+      for (const Particle &nucleon : nucleons) {
+        if (single) {
+          store.prefilter_close_momenta(nucleon.momentum, deltap * deltap,
+                                        0, store.size(), selected, scratch);
+        } else {
+          store.select_close_momenta(nucleon.momentum, deltap * deltap, 0,
+                                     store.size(), selected, scratch);
+        }
+      }
+      sink = selected.size();
+    }), nucleons.size() * nucleons.size(), "pairs");
+  }
+
+  // Acceptance draws of the pairs in batches
+  const PairRandom pair_random(42, 0, 0);
+  report("PairRandom::uniform", seconds_per_call(min_time, [&]() {
+    double sum = 0.0;
+    for (uint32_t i = 0; i < nucleons.size(); i++) {
+      pair_random.uniform(0, i, positions.data(), positions.size(),
+                          weights.data());
+      sum += weights[0];
+    }
+    sink = sum;
+  }), nucleons.size() * nucleons.size(), "pairs");
+
+  // Whole events
+  for (size_t n : {100, 500, 2000}) {
+    const std::vector<Particle> event =
+        SyntheticSmashGenerator::nucleons(n, n);
+    std::vector<Particle> nuclei;
+    Coalescence::EventArena arena;
+    const PairRandom random(7, 0, 0);
+    report("coalesce, " + std::to_string(n) + " nucleons",
+           seconds_per_call(min_time, [&]() {
+      nuclei.clear();
+      sharp.coalesce(event, nuclei, random, arena);
+      sink = nuclei.size();
+    }), n, "particles");
+    report("coalesce_probabilistic, " + std::to_string(n) + " nucleons",
+           seconds_per_call(min_time, [&]() {
+      nuclei.clear();
+      probabilistic.coalesce_probabilistic(event, nuclei, arena);
+      sink = nuclei.size();
+    }), n, "particles");
+  }
+
+  // Reading of an extended SMASH file
+  char smash_file[] = "/tmp/coalescence_bench_XXXXXX";
+  const int fd = mkstemp(smash_file);
+  if (fd < 0) {
+    throw std::runtime_error("Can't create a temporary file");
+  }
+  close(fd);
+  constexpr size_t n_events = 20, n_particles = 5000;
+  SyntheticEventConfig config;
+  config.n_events = n_events;
+  config.multiplicity = n_particles;
+  SyntheticSmashGenerator(config).write(smash_file);
+  report("SmashBinaryReader::read_block", seconds_per_call(min_time, [&]() {
+    SmashBinaryReader reader(smash_file);
+    std::vector<Particle> hadrons;
+    while (reader.read_block(hadrons) !=
+           SmashBinaryReader::Block::end_of_input) {
+      hadrons.clear();
+    }
+    sink = reader.n_kept();
+  }), n_events * n_particles, "particles");
+  report("SmashBinaryReader::count_events", seconds_per_call(min_time, [&]() {
+    sink = SmashBinaryReader::count_events(smash_file);
+  }), n_events * n_particles, "particles");
+  std::remove(smash_file);
+  return 0;
+}
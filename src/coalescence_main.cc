@@ -1,8 +1,14 @@
 #include <getopt.h>
 
+#include "coalescence/checkpoint.h"
 #include "coalescence/coalescence.h"
+#include "coalescence/instrumentation.h"
+#include "coalescence/smash_binary_reader.h"
 
+#include <cstdio>
 #include <iostream>
+#include <random>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -14,14 +20,150 @@ void usage(const int rc, const std::string &progname) {
       "  -p, --dp                coalescence dp [GeV]\n"
       "  -r, --dr                coalescence dr [fm]\n"
       "  -w, --probabilistic     probabilistic coalescence, 3 exp(-dr2/d2 - dp2 * d2)\n"
+      "  -j, --parallel-files    process input files in parallel, each into\n"
+      "                          its own part of the output, which are\n"
+      "                          merged at the end\n"
+      "  -m, --mixed-events      <K> estimate the combinatorial background\n"
+      "                          by pairing nucleons of each event with\n"
+      "                          the ones of the K-1 events before it in\n"
+      "                          the same file, weights are divided by the\n"
+      "                          number of mixed events (default: 1, no\n"
+      "                          mixing)\n"
+      "  -a, --pair-search       search for coalescence partners on a\n"
+      "                          momentum grid, in a rapidity window, or\n"
+      "                          among all particles: grid, rapidity or\n"
+      "                          brute, all find the same nuclei\n"
+      "                          (default: grid)\n"
+      "  -g, --histogram         <species:variable=min,max,bins[:...]>\n"
+      "                          histogram of nuclei or hadrons over up to\n"
+      "                          three of the variables y, pt [GeV] and\n"
+      "                          impact parameter b [fm], for example\n"
+      "                          d:y=-4,4,40:pt=0,3,30, may be repeated\n"
+      "  -H, --histogram-output  file for all histograms, written in the\n"
+      "                          output format (default: not written)\n"
+      "  -J, --report-json       file for the times of the stages and\n"
+      "                          the counters of the run as JSON, they\n"
+      "                          are collected if the afterburner is\n"
+      "                          built with COALESCENCE_INSTRUMENTATION\n"
+      "  -s, --seed              random seed, results are reproducible\n"
+      "                          for a given seed and list of input files\n"
+      "                          (default: random)\n"
       "  -i, --inputfiles        <list of particle files>\n"
       "                          should be in SMASH extended binary format\n"
       "  -o, --outputfile        output file name, where the nuclei\n"
       "                          coordinates, momenta, and pdg ids\n"
       "                          will be printed out\n"
-      "                          (default: ./nuclei.bin)\n\n");
+      "                          (default: ./nuclei.dat)\n"
+      "  -f, --format            format of the output: text or binary\n"
+      "                          (default: text), binary files are\n"
+      "                          converted to text by nuclei_to_text\n"
+      "  -z, --compress          compress binary output with zlib\n"
+      "  -c, --checkpoint        file, to which the state of the run is\n"
+      "                          saved after each input file and between\n"
+      "                          events (default: no checkpoints)\n"
+      "  -C, --checkpoint-interval\n"
+      "                          seconds between checkpoints within a\n"
+      "                          file (default: 60)\n"
+      "  -R, --resume            continue the run from the checkpoint, if\n"
+      "                          there is one, with the same options and\n"
+      "                          input files, the seed is taken from it\n\n");
   std::exit(rc);
 }
+
+bool file_exists(const std::string &file) {
+  FILE *f = std::fopen(file.c_str(), "rb");
+  if (f != NULL) {
+    std::fclose(f);
+  }
+  return f != NULL;
+}
+
+/**
+ * Process every input file with its own Coalescence object writing to a
+ * separate part of the output, then merge the parts and histograms into
+ * \p coalescence in the order of files. Events are numbered as in the
+ * sequential run, so that the results are the same. With a
+ * \p checkpoint_file each part has its own checkpoint next to it, from
+ * which it is continued if \p resume is set.
+ */
+void make_nuclei_parallel_files(coalescence::Coalescence &coalescence,
+                                const std::vector<std::string> &input_files,
+                                const std::string &output_file,
+                                double dp, double dr, bool probabilistic,
+                                size_t mixing_window,
+                                coalescence::PairSearch pair_search,
+                                const std::vector<coalescence::Histogram>
+                                    &extra_histograms,
+                                uint64_t seed, coalescence::OutputFormat format,
+                                bool compress,
+                                const std::string &checkpoint_file,
+                                double checkpoint_interval, bool resume) {
+  using coalescence::Coalescence;
+  using coalescence::SmashBinaryReader;
+  const size_t n_files = input_files.size();
+  std::vector<size_t> first_event(n_files + 1, 0);
+  for (size_t i = 0; i < n_files; i++) {
+    first_event[i + 1] = first_event[i] +
+                         SmashBinaryReader::count_events(input_files[i]);
+  }
+  std::vector<std::string> parts(n_files);
+  for (size_t i = 0; i < n_files; i++) {
+    parts[i] = output_file + ".part" + std::to_string(i);
+  }
+
+  std::vector<std::string> part_checkpoints(n_files);
+  if (!checkpoint_file.empty()) {
+    for (size_t i = 0; i < n_files; i++) {
+      part_checkpoints[i] = checkpoint_file + ".part" + std::to_string(i);
+    }
+  }
+
+  std::vector<coalescence::HistogramSet> histograms(n_files);
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < n_files; i++) {
+    coalescence::Checkpoint state;
+    const bool resumed = resume && !part_checkpoints[i].empty() &&
+                         file_exists(part_checkpoints[i]);
+    if (resumed) {
+      state = coalescence::Checkpoint::read(part_checkpoints[i]);
+    }
+    Coalescence worker(parts[i], dp, dr, probabilistic, seed,
+                       format, compress, state.output_size);
+    worker.set_mixing_window(mixing_window);
+    worker.set_pair_search(pair_search);
+    for (const coalescence::Histogram &histogram : extra_histograms) {
+      worker.add_histogram(histogram);
+    }
+    worker.set_event_number(first_event[i]);
+    if (resumed) {
+      worker.restore(state);
+    }
+    if (!part_checkpoints[i].empty()) {
+      worker.set_checkpoint(part_checkpoints[i], checkpoint_interval);
+    }
+    // A part checkpointed after its file is complete
+    if (state.file_index <= i) {
+      worker.make_nuclei(input_files[i], i, state.events_done);
+    }
+    worker.flush_output();
+    histograms[i] = worker.histograms();
+  }
+
+  for (size_t i = 0; i < n_files; i++) {
+    coalescence.merge_histograms(histograms[i]);
+    coalescence.append_output(parts[i]);
+  }
+  // The parts are only needed until the merged run is checkpointed
+  if (!checkpoint_file.empty()) {
+    coalescence.write_checkpoint(n_files, 0);
+  }
+  for (size_t i = 0; i < n_files; i++) {
+    std::remove(parts[i].c_str());
+    if (!part_checkpoints[i].empty()) {
+      std::remove(part_checkpoints[i].c_str());
+    }
+  }
+}
 };  // unnamed namespace
 
 int main(int argc, char **argv) {
@@ -34,8 +176,20 @@ int main(int argc, char **argv) {
       {"dp", required_argument, 0, 'p'},
       {"dr", required_argument, 0, 'r'},
       {"probabilistic", no_argument, 0, 'w'},
+      {"parallel-files", no_argument, 0, 'j'},
+      {"mixed-events", required_argument, 0, 'm'},
+      {"pair-search", required_argument, 0, 'a'},
+      {"histogram", required_argument, 0, 'g'},
+      {"histogram-output", required_argument, 0, 'H'},
+      {"report-json", required_argument, 0, 'J'},
+      {"seed", required_argument, 0, 's'},
       {"inputfiles", required_argument, 0, 'i'},
       {"outputfile", required_argument, 0, 'o'},
+      {"format", required_argument, 0, 'f'},
+      {"compress", no_argument, 0, 'z'},
+      {"checkpoint", required_argument, 0, 'c'},
+      {"checkpoint-interval", required_argument, 0, 'C'},
+      {"resume", no_argument, 0, 'R'},
       {nullptr, 0, 0, 0}};
 
   const std::string full_progname = std::string(argv[0]);
@@ -46,8 +200,20 @@ int main(int argc, char **argv) {
   double inputdp = 0.44;  // GeV
   double inputdr = 2.0 * M_PI * 0.19732 / inputdp;  // fm
   bool probabilistic = false;
+  bool parallel_files = false;
+  size_t mixing_window = 1;
+  PairSearch pair_search = PairSearch::grid;
+  std::vector<Histogram> extra_histograms;
+  std::string histogram_file;
+  std::string report_file;
+  OutputFormat output_format = OutputFormat::text;
+  bool compress_output = false;
+  std::string checkpoint_file;
+  double checkpoint_interval = 60.0;  // s
+  bool resume = false;
+  uint64_t seed = std::random_device()();
 
-  while ((opt = getopt_long(argc, argv, "hi:o:p:r:w",
+  while ((opt = getopt_long(argc, argv, "a:c:C:f:g:hH:i:jJ:m:o:p:r:Rs:wz",
           longopts, nullptr)) != -1) {
     switch (opt) {
       case 'h':
@@ -62,6 +228,45 @@ int main(int argc, char **argv) {
       case 'w':
         probabilistic = true;
         break;
+      case 'j':
+        parallel_files = true;
+        break;
+      case 'J':
+        report_file = optarg;
+        break;
+      case 'm':
+        {
+          const long window = std::stol(optarg);
+          if (window < 1) {
+            std::cout << "Number of mixed events should be positive"
+                      << std::endl;
+            usage(EXIT_FAILURE, progname);
+          }
+          mixing_window = static_cast<size_t>(window);
+          break;
+        }
+      case 'a':
+        try {
+          pair_search = pair_search_from_name(optarg);
+        } catch (std::invalid_argument &) {
+          std::cout << "Unknown pair search " << optarg << std::endl;
+          usage(EXIT_FAILURE, progname);
+        }
+        break;
+      case 'g':
+        try {
+          extra_histograms.push_back(Histogram::from_spec(optarg));
+        } catch (std::invalid_argument &e) {
+          std::cout << e.what() << std::endl;
+          usage(EXIT_FAILURE, progname);
+        }
+        break;
+      case 'H':
+        histogram_file = optarg;
+        break;
+      case 's':
+        seed = std::stoull(optarg);
+        break;
       case 'i':
         {
           // A little hack from
@@ -77,6 +282,28 @@ int main(int argc, char **argv) {
       case 'o':
         if (optarg) { output_file = optarg; }
         break;
+      case 'f':
+        if (std::string(optarg) == "text") {
+          output_format = OutputFormat::text;
+        } else if (std::string(optarg) == "binary") {
+          output_format = OutputFormat::binary;
+        } else {
+          std::cout << "Unknown output format " << optarg << std::endl;
+          usage(EXIT_FAILURE, progname);
+        }
+        break;
+      case 'z':
+        compress_output = true;
+        break;
+      case 'c':
+        checkpoint_file = optarg;
+        break;
+      case 'C':
+        checkpoint_interval = std::stod(optarg);
+        break;
+      case 'R':
+        resume = true;
+        break;
      default:
         usage(EXIT_FAILURE, progname);
     }
@@ -88,6 +315,34 @@ int main(int argc, char **argv) {
     usage(EXIT_FAILURE, progname);
   }
 
+  // A missing checkpoint means, that the run has not got that far yet
+  Checkpoint resume_state;
+  bool resuming = false;
+  if (resume) {
+    if (checkpoint_file.empty()) {
+      std::cout << "Resuming needs a checkpoint file" << std::endl;
+      usage(EXIT_FAILURE, progname);
+    }
+    if (file_exists(checkpoint_file)) {
+      resume_state = Checkpoint::read(checkpoint_file);
+      resuming = true;
+      seed = resume_state.seed;
+    }
+  }
+  if (resume_state.file_index > input_files.size()) {
+    std::cout << "The checkpoint is from a run with more input files"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  const bool resume_within_run =
+      resume_state.file_index > 0 || resume_state.events_done > 0;
+  if (parallel_files && resume_within_run &&
+      resume_state.file_index < input_files.size()) {
+    std::cout << "The checkpoint is from a run without --parallel-files"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
   std::cout << "Input files: ";
   for (const std::string &input_file : input_files) {
     std::cout << input_file << " ";
@@ -95,13 +350,66 @@ int main(int argc, char **argv) {
   std::cout << "\nOutput file: " << output_file << std::endl;
   if (!probabilistic) {
     std::cout << "\n dp = " << inputdp << ", dr =  " << inputdr << std::endl;
+    std::cout << "Pair search: " << pair_search_name(pair_search)
+              << std::endl;
   } else {
     std::cout << "Printing out coalescence weights"
               << " according to deuteron Wigner function." << std::endl;
+    std::cout << "Pair weight kernel: "
+              << simd_level_name(best_simd_level()) << std::endl;
   }
-  Coalescence coalescence(output_file, inputdp, inputdr, probabilistic);
-  for (const std::string &input_file : input_files) {
-    coalescence.make_nuclei(input_file);
+  if (mixing_window > 1) {
+    std::cout << "Mixing " << mixing_window << " events" << std::endl;
+  }
+  std::cout << "Random seed: " << seed << std::endl;
+  if (resuming) {
+    std::cout << "Resuming at file " << resume_state.file_index
+              << " after " << resume_state.events_done << " events of it"
+              << std::endl;
+  }
+  Coalescence coalescence(output_file, inputdp, inputdr, probabilistic, seed,
+                          output_format, compress_output,
+                          resume_state.output_size);
+  coalescence.set_mixing_window(mixing_window);
+  coalescence.set_pair_search(pair_search);
+  for (const Histogram &histogram : extra_histograms) {
+    coalescence.add_histogram(histogram);
+  }
+  if (resuming) {
+    coalescence.restore(resume_state);
+  }
+  if (!checkpoint_file.empty()) {
+    coalescence.set_checkpoint(checkpoint_file, checkpoint_interval);
+    // Keeps the seed, even if the run stops before the first file is done
+    coalescence.write_checkpoint(resume_state.file_index,
+                                 resume_state.events_done);
   }
+  if (parallel_files) {
+    if (resume_state.file_index < input_files.size()) {
+      make_nuclei_parallel_files(coalescence, input_files, output_file,
+                                 inputdp, inputdr, probabilistic,
+                                 mixing_window, pair_search, extra_histograms,
+                                 seed,
+                                 output_format, compress_output,
+                                 checkpoint_file, checkpoint_interval,
+                                 resuming);
+    }
+  } else {
+    for (size_t i = resume_state.file_index; i < input_files.size(); i++) {
+      coalescence.make_nuclei(input_files[i], i,
+                              i == resume_state.file_index ?
+                              resume_state.events_done : 0);
+    }
+  }
+  coalescence.flush_output();
   coalescence.print_histograms();
+  if (!histogram_file.empty()) {
+    coalescence.write_histograms(histogram_file, output_format);
+  }
+  if (instrumentation_enabled) {
+    print_run_report(stdout);
+  }
+  if (!report_file.empty()) {
+    write_run_report_json(report_file);
+  }
 }
@@ -0,0 +1,418 @@
+#include "coalescence/histograms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace coalescence {
+
+namespace {
+
+constexpr char magic_number[4] = {'H', 'I', 'S', 'T'};
+constexpr uint16_t binary_version = 2;
+
+// Names of the particle types in histogram descriptions
+const char *const type_names[] = {
+    "boring", "p", "n", "la", "sig0", "ap", "an", "ala", "asig0",
+    "d", "t", "He3", "H3L", "He4", "ad", "at", "aHe3"};
+static_assert(sizeof(type_names) / sizeof(type_names[0]) == n_particle_types,
+              "A name is needed for every particle type");
+
+const char *variable_name(HistogramVariable variable) {
+  switch (variable) {
+    case HistogramVariable::rapidity: return "y";
+    case HistogramVariable::pt: return "pt";
+    case HistogramVariable::impact_parameter: return "b";
+  }
+  return "unknown";
+}
+
+double variable_value(HistogramVariable variable, const Particle &particle,
+                      double impact_parameter) {
+  switch (variable) {
+    case HistogramVariable::rapidity: return particle.kin.rapidity;
+    case HistogramVariable::pt: return particle.kin.pt;
+    case HistogramVariable::impact_parameter: return impact_parameter;
+  }
+  return 0.0;
+}
+
+std::vector<std::string> split(const std::string &s, char separator) {
+  std::vector<std::string> parts;
+  size_t begin = 0;
+  while (true) {
+    const size_t end = s.find(separator, begin);
+    parts.push_back(s.substr(begin, end - begin));
+    if (end == std::string::npos) {
+      return parts;
+    }
+    begin = end + 1;
+  }
+}
+
+template <typename T>
+void write_value(FILE *output, const T &value) {
+  std::fwrite(&value, sizeof(T), 1, output);
+}
+
+template <typename T>
+T read_value(FILE *input) {
+  T value;
+  if (std::fread(&value, sizeof(T), 1, input) != 1) {
+    throw std::runtime_error("Unexpected end of histogram data");
+  }
+  return value;
+}
+
+void read_values(FILE *input, std::vector<double> &values) {
+  if (std::fread(values.data(), sizeof(double), values.size(), input) !=
+      values.size()) {
+    throw std::runtime_error("Unexpected end of histogram data");
+  }
+}
+
+}  // unnamed namespace
+
+constexpr int HistogramAxis::undefined;
+
+int HistogramAxis::bin(double x) const {
+  if (std::isnan(x)) {
+    return undefined;
+  }
+  // Clamped before the conversion, which is undefined for values out of
+  // the int range, infinities included
+  const double u = std::fmin(std::fmax((x - min) / (max - min) * n_bins,
+                                       -1.0),
+                             static_cast<double>(n_bins));
+  return static_cast<int>(std::floor(u));
+}
+
+Histogram::Histogram(ParticleType species,
+                     const std::vector<HistogramAxis> &axes) :
+    species_(species), axes_(axes) {
+  if (axes_.empty() || axes_.size() > 3) {
+    throw std::invalid_argument("Histograms have one to three axes");
+  }
+  size_t n_values = 1;
+  for (size_t a = 0; a < axes_.size(); a++) {
+    if (axes_[a].n_bins < 1 || !(axes_[a].max > axes_[a].min) ||
+        !std::isfinite(axes_[a].min) || !std::isfinite(axes_[a].max)) {
+      throw std::invalid_argument("Invalid histogram axis");
+    }
+    if (axes_[a].variable == HistogramVariable::impact_parameter) {
+      b_axis_ = static_cast<int>(a);
+    }
+    n_values *= axes_[a].n_bins + 2;
+  }
+  values_.assign(n_values, 0.0);
+  n_events_.assign(b_axis_ >= 0 ? axes_[b_axis_].n_bins + 2 : 1, 0.0);
+}
+
+Histogram Histogram::from_spec(const std::string &spec) {
+  const std::vector<std::string> fields = split(spec, ':');
+  ParticleType species = ParticleType::boring;
+  for (size_t type = 1; type < n_particle_types; type++) {
+    if (fields[0] == type_names[type]) {
+      species = static_cast<ParticleType>(type);
+    }
+  }
+  if (species == ParticleType::boring) {
+    throw std::invalid_argument("Unknown particle type in histogram " + spec);
+  }
+  std::vector<HistogramAxis> axes;
+  for (size_t f = 1; f < fields.size(); f++) {
+    const size_t equals = fields[f].find('=');
+    const std::vector<std::string> range =
+        split(fields[f].substr(equals + 1), ',');
+    if (equals == std::string::npos || range.size() != 3) {
+      throw std::invalid_argument("Invalid axis in histogram " + spec);
+    }
+    const std::string name = fields[f].substr(0, equals);
+    HistogramAxis axis;
+    if (name == "y") {
+      axis.variable = HistogramVariable::rapidity;
+    } else if (name == "pt") {
+      axis.variable = HistogramVariable::pt;
+    } else if (name == "b") {
+      axis.variable = HistogramVariable::impact_parameter;
+    } else {
+      throw std::invalid_argument("Unknown variable in histogram " + spec);
+    }
+    try {
+      axis.min = std::stod(range[0]);
+      axis.max = std::stod(range[1]);
+      axis.n_bins = std::stoi(range[2]);
+    } catch (std::exception &) {
+      throw std::invalid_argument("Invalid axis in histogram " + spec);
+    }
+    axes.push_back(axis);
+  }
+  return Histogram(species, axes);
+}
+
+size_t Histogram::flat_index(const std::array<int, 3> &bins) const {
+  size_t index = 0;
+  for (size_t a = 0; a < axes_.size(); a++) {
+    index = index * (axes_[a].n_bins + 2) + (bins[a] + 1);
+  }
+  return index;
+}
+
+std::array<int, 3> Histogram::bins_of(size_t index) const {
+  std::array<int, 3> bins = {0, 0, 0};
+  for (size_t a = axes_.size(); a-- > 0;) {
+    bins[a] = static_cast<int>(index % (axes_[a].n_bins + 2)) - 1;
+    index /= axes_[a].n_bins + 2;
+  }
+  return bins;
+}
+
+void Histogram::fill(const Particle &particle, double impact_parameter) {
+  std::array<int, 3> bins = {0, 0, 0};
+  for (size_t a = 0; a < axes_.size(); a++) {
+    bins[a] = axes_[a].bin(
+        variable_value(axes_[a].variable, particle, impact_parameter));
+    if (bins[a] == HistogramAxis::undefined) {
+      undefined_ += particle.weight;
+      return;
+    }
+  }
+  values_[flat_index(bins)] += particle.weight;
+}
+
+void Histogram::add_event(double impact_parameter) {
+  if (b_axis_ < 0) {
+    n_events_[0] += 1.0;
+    return;
+  }
+  const int i = axes_[b_axis_].bin(impact_parameter);
+  if (i == HistogramAxis::undefined) {
+    undefined_events_ += 1.0;
+  } else {
+    n_events_[i + 1] += 1.0;
+  }
+}
+
+void Histogram::merge(const Histogram &other) {
+  for (size_t i = 0; i < values_.size(); i++) {
+    values_[i] += other.values_[i];
+  }
+  for (size_t i = 0; i < n_events_.size(); i++) {
+    n_events_[i] += other.n_events_[i];
+  }
+  undefined_ += other.undefined_;
+  undefined_events_ += other.undefined_events_;
+}
+
+void Histogram::clear() {
+  std::fill(values_.begin(), values_.end(), 0.0);
+  std::fill(n_events_.begin(), n_events_.end(), 0.0);
+  undefined_ = 0.0;
+  undefined_events_ = 0.0;
+}
+
+bool Histogram::same_binning(const Histogram &other) const {
+  if (species_ != other.species_ || axes_.size() != other.axes_.size()) {
+    return false;
+  }
+  for (size_t a = 0; a < axes_.size(); a++) {
+    if (axes_[a].variable != other.axes_[a].variable ||
+        axes_[a].min != other.axes_[a].min ||
+        axes_[a].max != other.axes_[a].max ||
+        axes_[a].n_bins != other.axes_[a].n_bins) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double Histogram::n_events(const std::array<int, 3> &bins) const {
+  return n_events_[b_axis_ >= 0 ? bins[b_axis_] + 1 : 0];
+}
+
+double Histogram::density(const std::array<int, 3> &bins) const {
+  double norm = n_events(bins);
+  for (size_t a = 0; a < axes_.size(); a++) {
+    if (static_cast<int>(a) != b_axis_) {
+      norm *= axes_[a].width();
+    }
+  }
+  return norm > 0.0 ? value(bins) / norm : 0.0;
+}
+
+void Histogram::write_text(FILE *output) const {
+  std::fprintf(output, "# histogram %s",
+               type_names[static_cast<size_t>(species_)]);
+  for (const HistogramAxis &axis : axes_) {
+    std::fprintf(output, " %s=%g,%g,%d", variable_name(axis.variable),
+                 axis.min, axis.max, axis.n_bins);
+  }
+  std::fprintf(output, "\n#");
+  for (const HistogramAxis &axis : axes_) {
+    std::fprintf(output, " %s", variable_name(axis.variable));
+  }
+  std::fprintf(output, " sum density\n");
+  double outside = 0.0;
+  for (size_t i = 0; i < values_.size(); i++) {
+    const std::array<int, 3> bins = bins_of(i);
+    bool in_range = true;
+    for (size_t a = 0; a < axes_.size(); a++) {
+      in_range = in_range && bins[a] >= 0 && bins[a] < axes_[a].n_bins;
+    }
+    if (!in_range) {
+      outside += values_[i];
+      continue;
+    }
+    for (size_t a = 0; a < axes_.size(); a++) {
+      std::fprintf(output, "%10.4f ", axes_[a].center(bins[a]));
+    }
+    std::fprintf(output, "%14.6e %14.6e\n", value(bins), density(bins));
+  }
+  std::fprintf(output, "# outside of the range %14.6e\n", outside);
+  std::fprintf(output, "# undefined (NaN) %14.6e\n\n", undefined_);
+}
+
+void Histogram::write_binary(FILE *output) const {
+  write_value(output, static_cast<int32_t>(species_));
+  write_value(output, static_cast<uint32_t>(axes_.size()));
+  for (const HistogramAxis &axis : axes_) {
+    write_value(output, static_cast<int32_t>(axis.variable));
+    write_value(output, axis.min);
+    write_value(output, axis.max);
+    write_value(output, static_cast<int32_t>(axis.n_bins));
+  }
+  std::fwrite(n_events_.data(), sizeof(double), n_events_.size(), output);
+  std::fwrite(values_.data(), sizeof(double), values_.size(), output);
+  write_value(output, undefined_);
+  write_value(output, undefined_events_);
+}
+
+Histogram Histogram::read_binary(FILE *input) {
+  const int32_t species = read_value<int32_t>(input);
+  const uint32_t n_axes = read_value<uint32_t>(input);
+  if (species <= 0 || species >= static_cast<int32_t>(n_particle_types) ||
+      n_axes < 1 || n_axes > 3) {
+    throw std::runtime_error("Invalid histogram data");
+  }
+  std::vector<HistogramAxis> axes(n_axes);
+  for (HistogramAxis &axis : axes) {
+    const int32_t variable = read_value<int32_t>(input);
+    if (variable < 0 ||
+        variable > static_cast<int32_t>(HistogramVariable::impact_parameter)) {
+      throw std::runtime_error("Invalid histogram data");
+    }
+    axis.variable = static_cast<HistogramVariable>(variable);
+    axis.min = read_value<double>(input);
+    axis.max = read_value<double>(input);
+    axis.n_bins = read_value<int32_t>(input);
+  }
+  try {
+    Histogram histogram(static_cast<ParticleType>(species), axes);
+    read_values(input, histogram.n_events_);
+    read_values(input, histogram.values_);
+    histogram.undefined_ = read_value<double>(input);
+    histogram.undefined_events_ = read_value<double>(input);
+    return histogram;
+  } catch (std::invalid_argument &) {
+    throw std::runtime_error("Invalid histogram data");
+  }
+}
+
+void HistogramSet::add(const Histogram &histogram) {
+  histograms_.push_back(histogram);
+  // Rebuild the slot table, keeping the histograms of a type in order
+  slots_.clear();
+  for (size_t type = 0; type <= n_particle_types; type++) {
+    slot_begin_[type] = static_cast<uint32_t>(slots_.size());
+    for (size_t i = 0; i < histograms_.size(); i++) {
+      if (static_cast<size_t>(histograms_[i].species()) == type) {
+        slots_.push_back(static_cast<uint32_t>(i));
+      }
+    }
+  }
+  slot_begin_[n_particle_types + 1] = static_cast<uint32_t>(slots_.size());
+}
+
+void HistogramSet::fill(const Particle &particle, double impact_parameter) {
+  // Invalid particles and unknown types go to the empty last row
+  const size_t type = std::min(
+      static_cast<size_t>(static_cast<unsigned char>(particle.type)),
+      n_particle_types);
+  const size_t row = particle.valid ? type : n_particle_types;
+  for (uint32_t k = slot_begin_[row]; k < slot_begin_[row + 1]; k++) {
+    histograms_[slots_[k]].fill(particle, impact_parameter);
+  }
+}
+
+void HistogramSet::add_event(double impact_parameter) {
+  n_events_ += 1.0;
+  for (Histogram &histogram : histograms_) {
+    histogram.add_event(impact_parameter);
+  }
+}
+
+void HistogramSet::merge(const HistogramSet &other) {
+  if (other.histograms_.size() != histograms_.size()) {
+    throw std::invalid_argument("Merging different sets of histograms");
+  }
+  for (size_t i = 0; i < histograms_.size(); i++) {
+    histograms_[i].merge(other.histograms_[i]);
+  }
+  n_events_ += other.n_events_;
+}
+
+void HistogramSet::clear() {
+  for (Histogram &histogram : histograms_) {
+    histogram.clear();
+  }
+  n_events_ = 0.0;
+}
+
+void HistogramSet::write(const std::string &file,
+                         OutputFormat format) const {
+  const bool binary = format == OutputFormat::binary;
+  FILE *output = std::fopen(file.c_str(), binary ? "wb" : "w");
+  if (output == NULL) {
+    throw std::runtime_error("Can't open file " + file);
+  }
+  if (binary) {
+    std::fwrite(magic_number, 1, sizeof(magic_number), output);
+    write_value(output, binary_version);
+    write_value(output, static_cast<uint32_t>(histograms_.size()));
+  } else {
+    std::fprintf(output, "# events %.0f\n\n", n_events_);
+  }
+  for (const Histogram &histogram : histograms_) {
+    if (binary) {
+      histogram.write_binary(output);
+    } else {
+      histogram.write_text(output);
+    }
+  }
+  const bool failed = std::ferror(output) != 0;
+  if (std::fclose(output) != 0 || failed) {
+    throw std::runtime_error("Failed to write " + file);
+  }
+}
+
+void HistogramSet::write_state(FILE *output) const {
+  write_value(output, n_events_);
+  write_value(output, static_cast<uint32_t>(histograms_.size()));
+  for (const Histogram &histogram : histograms_) {
+    histogram.write_binary(output);
+  }
+}
+
+HistogramSet HistogramSet::read_state(FILE *input) {
+  HistogramSet set;
+  set.n_events_ = read_value<double>(input);
+  const uint32_t n_histograms = read_value<uint32_t>(input);
+  for (uint32_t i = 0; i < n_histograms; i++) {
+    set.add(Histogram::read_binary(input));
+  }
+  return set;
+}
+
+}  // namespace coalescence
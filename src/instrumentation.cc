@@ -0,0 +1,128 @@
+#include "coalescence/instrumentation.h"
+
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace coalescence {
+
+namespace {
+
+#ifdef COALESCENCE_INSTRUMENTATION
+// Records of all threads, which outlive the threads themselves
+std::mutex records_mutex;
+std::vector<std::unique_ptr<RunRecord>> records;
+#endif
+
+}  // unnamed namespace
+
+#ifdef COALESCENCE_INSTRUMENTATION
+thread_local RunRecord *current_run_record = nullptr;
+
+RunRecord *register_run_record() {
+  std::lock_guard<std::mutex> lock(records_mutex);
+  records.emplace_back(new RunRecord());
+  return records.back().get();
+}
+#endif
+
+const char *run_stage_name(RunStage stage) {
+  switch (stage) {
+    case RunStage::read: return "read";
+    case RunStage::filter: return "filter";
+    case RunStage::pair_search: return "pair_search";
+    case RunStage::nuclei: return "nuclei";
+    case RunStage::output: return "output";
+    case RunStage::histograms: return "histograms";
+  }
+  return "unknown";
+}
+
+const char *run_counter_name(RunCounter counter) {
+  switch (counter) {
+    case RunCounter::events: return "events";
+    case RunCounter::particles_read: return "particles_read";
+    case RunCounter::nucleons_kept: return "nucleons_kept";
+    case RunCounter::pairs_tested: return "pairs_tested";
+    case RunCounter::pairs_momentum_cut: return "pairs_momentum_cut";
+    case RunCounter::pairs_spatial_cut: return "pairs_spatial_cut";
+    case RunCounter::nuclei_produced: return "nuclei_produced";
+  }
+  return "unknown";
+}
+
+RunRecord run_record_total(size_t &n_threads) {
+  RunRecord total;
+  n_threads = 0;
+#ifdef COALESCENCE_INSTRUMENTATION
+  std::lock_guard<std::mutex> lock(records_mutex);
+  for (const std::unique_ptr<RunRecord> &record : records) {
+    for (size_t s = 0; s < n_run_stages; s++) {
+      total.nanoseconds[s] += record->nanoseconds[s];
+      total.calls[s] += record->calls[s];
+    }
+    for (size_t c = 0; c < n_run_counters; c++) {
+      total.counters[c] += record->counters[c];
+    }
+  }
+  n_threads = records.size();
+#endif
+  return total;
+}
+
+void print_run_report(FILE *output) {
+  if (!instrumentation_enabled) {
+    std::fprintf(output, "Instrumentation is not compiled in, build with "
+                         "-DCOALESCENCE_INSTRUMENTATION=ON\n");
+    return;
+  }
+  size_t n_threads;
+  const RunRecord total = run_record_total(n_threads);
+  std::fprintf(output, "\n# stage         thread time [s]        calls"
+                       "   (summed over %zu threads)\n", n_threads);
+  for (size_t s = 0; s < n_run_stages; s++) {
+    std::fprintf(output, "%-14s %16.4f %12llu\n",
+                 run_stage_name(static_cast<RunStage>(s)),
+                 1e-9 * total.nanoseconds[s],
+                 static_cast<unsigned long long>(total.calls[s]));
+  }
+  std::fprintf(output, "# counter\n");
+  for (size_t c = 0; c < n_run_counters; c++) {
+    std::fprintf(output, "%-20s %16llu\n",
+                 run_counter_name(static_cast<RunCounter>(c)),
+                 static_cast<unsigned long long>(total.counters[c]));
+  }
+}
+
+void write_run_report_json(const std::string &file) {
+  FILE *output = std::fopen(file.c_str(), "w");
+  if (output == NULL) {
+    throw std::runtime_error("Can't open file " + file);
+  }
+  size_t n_threads;
+  const RunRecord total = run_record_total(n_threads);
+  std::fprintf(output, "{\n  \"enabled\": %s,\n  \"threads\": %zu,\n"
+               "  \"stages\": {", instrumentation_enabled ? "true" : "false",
+               n_threads);
+  for (size_t s = 0; s < n_run_stages; s++) {
+    std::fprintf(output, "%s\n    \"%s\": {\"seconds\": %.9f, "
+                 "\"calls\": %llu}", s > 0 ? "," : "",
+                 run_stage_name(static_cast<RunStage>(s)),
+                 1e-9 * total.nanoseconds[s],
+                 static_cast<unsigned long long>(total.calls[s]));
+  }
+  std::fprintf(output, "\n  },\n  \"counters\": {");
+  for (size_t c = 0; c < n_run_counters; c++) {
+    std::fprintf(output, "%s\n    \"%s\": %llu", c > 0 ? "," : "",
+                 run_counter_name(static_cast<RunCounter>(c)),
+                 static_cast<unsigned long long>(total.counters[c]));
+  }
+  std::fprintf(output, "\n  }\n}\n");
+  const bool failed = std::ferror(output) != 0;
+  if (std::fclose(output) != 0 || failed) {
+    throw std::runtime_error("Failed to write " + file);
+  }
+}
+
+}  // namespace coalescence
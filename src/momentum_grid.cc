@@ -0,0 +1,142 @@
+#include "coalescence/momentum_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace coalescence {
+
+namespace {
+// Relative safety margin of the bounds against rounding
+constexpr double margin = 1e-6;
+// Upper limit on the number of cells along one axis
+constexpr int max_cells = 64;
+
+template <typename Vector>
+size_t reserved_bytes(const Vector &v) {
+  return v.capacity() * sizeof(typename Vector::value_type);
+}
+}  // unnamed namespace
+
+ThreeVector MomentumGrid::ball_coordinates(const FourVector &p) {
+  const double m = std::sqrt(std::max(p.sqr(), 0.0));
+  return p.threevec() / (p.x0() + m);
+}
+
+double MomentumGrid::min_mass(const std::vector<Particle> &particles) {
+  double m2 = std::numeric_limits<double>::max();
+  for (const Particle &particle : particles) {
+    m2 = std::min(m2, particle.momentum.sqr());
+  }
+  return std::sqrt(std::max(m2, 0.0));
+}
+
+double MomentumGrid::max_relative_gamma(double m1, double m2,
+                                        double deltap) {
+  // In the center of mass frame p1 = -p2 with |p1| = deltap / 2
+  const double k2 = 0.25 * deltap * deltap;
+  return (std::sqrt((m1 * m1 + k2) * (m2 * m2 + k2)) + k2) / (m1 * m2);
+}
+
+double MomentumGrid::max_distance(double m1, double m2, double deltap) {
+  // The whole ball has diameter 2, no restriction is possible
+  if (m1 <= 0.0 || m2 <= 0.0) {
+    return 2.0;
+  }
+  const double gamma_rel = max_relative_gamma(m1, m2, deltap);
+  const double d = std::sqrt(0.5 * (gamma_rel - 1.0)) * (1.0 + margin);
+  return std::min(d, 2.0);
+}
+
+int MomentumGrid::cell_of(double x) const {
+  const int i = static_cast<int>(std::floor((x + 1.0) / cell_size_));
+  return std::min(std::max(i, 0), n_cells_ - 1);
+}
+
+void MomentumGrid::build(const std::vector<Particle> &particles,
+                         double cell_size) {
+  n_cells_ = std::max(1, std::min(max_cells,
+                 static_cast<int>(std::floor(2.0 / cell_size))));
+  cell_size_ = 2.0 / n_cells_;
+  min_mass_ = min_mass(particles);
+  const size_t n_total = static_cast<size_t>(n_cells_) * n_cells_ * n_cells_;
+  const size_t N = particles.size();
+
+  // Counting sort of the particles by cell
+  cell_start_.assign(n_total + 1, 0);
+  cell_.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    const ThreeVector x = ball_coordinates(particles[i].momentum);
+    cell_[i] = (static_cast<size_t>(cell_of(x.x1())) * n_cells_ +
+                cell_of(x.x2())) * n_cells_ + cell_of(x.x3());
+    cell_start_[cell_[i] + 1]++;
+  }
+  for (size_t c = 0; c < n_total; c++) {
+    cell_start_[c + 1] += cell_start_[c];
+  }
+  fill_.assign(cell_start_.begin(), cell_start_.end() - 1);
+  index_.resize(N);
+  position_.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    const size_t pos = fill_[cell_[i]]++;
+    index_[pos] = i;
+    position_[i] = pos;
+  }
+  nucleons_.clear();
+  nucleons_.reserve(N);
+  for (size_t pos = 0; pos < N; pos++) {
+    nucleons_.push_back(particles[index_[pos]]);
+  }
+}
+
+size_t MomentumGrid::memory_size() const {
+  return reserved_bytes(cell_start_) + reserved_bytes(index_) +
+         reserved_bytes(position_) + reserved_bytes(cell_) +
+         reserved_bytes(fill_) + reserved_bytes(positions_) +
+         reserved_bytes(scratch_) + nucleons_.memory_size();
+}
+
+void MomentumGrid::reserve_like(const MomentumGrid &other, double factor) {
+  cell_start_.reserve(scaled_capacity(other.cell_start_.capacity(), factor));
+  nucleons_.reserve(scaled_capacity(other.nucleons_.capacity(), factor));
+  index_.reserve(scaled_capacity(other.index_.capacity(), factor));
+  position_.reserve(scaled_capacity(other.position_.capacity(), factor));
+  cell_.reserve(scaled_capacity(other.cell_.capacity(), factor));
+  fill_.reserve(scaled_capacity(other.fill_.capacity(), factor));
+  positions_.reserve(scaled_capacity(other.positions_.capacity(), factor));
+  scratch_.reserve(scaled_capacity(other.scratch_.capacity(), factor));
+}
+
+void MomentumGrid::find_candidates(const FourVector &p, double deltap,
+                                   std::vector<size_t> &candidates) {
+  candidates.clear();
+  positions_.clear();
+  const double m = std::sqrt(std::max(p.sqr(), 0.0));
+  const double max_distance = MomentumGrid::max_distance(m, min_mass_, deltap);
+  const double max_dp2 = deltap * deltap * (1.0 + margin);
+  const ThreeVector x = ball_coordinates(p);
+  const int reach = static_cast<int>(std::ceil(max_distance / cell_size_));
+  const int c1 = cell_of(x.x1()), c2 = cell_of(x.x2()), c3 = cell_of(x.x3());
+  const int i1_min = std::max(c1 - reach, 0),
+            i1_max = std::min(c1 + reach, n_cells_ - 1),
+            i2_min = std::max(c2 - reach, 0),
+            i2_max = std::min(c2 + reach, n_cells_ - 1),
+            i3_min = std::max(c3 - reach, 0),
+            i3_max = std::min(c3 + reach, n_cells_ - 1);
+  for (int i1 = i1_min; i1 <= i1_max; i1++) {
+    for (int i2 = i2_min; i2 <= i2_max; i2++) {
+      const size_t row = (static_cast<size_t>(i1) * n_cells_ + i2) * n_cells_;
+      // Cells along the last axis are contiguous in memory
+      nucleons_.prefilter_close_momenta(p, max_dp2,
+                                        cell_start_[row + i3_min],
+                                        cell_start_[row + i3_max + 1],
+                                        positions_, scratch_);
+    }
+  }
+  for (uint32_t pos : positions_) {
+    candidates.push_back(index_[pos]);
+  }
+  std::sort(candidates.begin(), candidates.end());
+}
+
+}  // namespace coalescence
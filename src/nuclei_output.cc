@@ -0,0 +1,361 @@
+#include "coalescence/nuclei_output.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+#ifdef COALESCENCE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace coalescence {
+
+namespace {
+
+constexpr char magic_number[4] = {'N', 'U', 'C', 'L'};
+constexpr uint16_t binary_version = 1;
+constexpr uint16_t flag_zlib = 1;
+constexpr size_t header_size = 8;
+constexpr size_t record_size = 8 * sizeof(double) + 3 * sizeof(int32_t) +
+                               sizeof(double);
+constexpr size_t event_header_size = 1 + sizeof(uint64_t) + sizeof(uint32_t);
+// Event blocks are compressed in chunks of about this size
+constexpr size_t chunk_size = 1 << 20;
+
+template <typename T>
+inline void put(std::vector<char> &buffer, const T &value) {
+  const char *bytes = reinterpret_cast<const char *>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+inline T get(const char *bytes) {
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+class TextNucleiWriter : public NucleiWriter {
+ public:
+  TextNucleiWriter(const std::string &output_file, uint64_t resume_offset) :
+      NucleiWriter(output_file, resume_offset) {}
+  void write_event(size_t event_number,
+                   const std::vector<Particle> &nuclei) override {
+    write_text_event(output_, event_number, nuclei);
+  }
+  void append(const std::string &file) override {
+    FILE *input = std::fopen(file.c_str(), "rb");
+    if (input == NULL) {
+      throw std::runtime_error("Can't open file " + file);
+    }
+    copy_rest(input, file);
+    std::fclose(input);
+  }
+};
+
+class BinaryNucleiWriter : public NucleiWriter {
+ public:
+  BinaryNucleiWriter(const std::string &output_file, bool compress,
+                     uint64_t resume_offset) :
+      NucleiWriter(output_file, resume_offset), compress_(compress) {
+#ifndef COALESCENCE_HAVE_ZLIB
+    if (compress_) {
+      throw std::runtime_error("Compressed output is not available," +
+                               std::string(" build without zlib."));
+    }
+#endif
+    const uint16_t flags = compress_ ? flag_zlib : 0;
+    if (resume_offset > 0) {
+      // The header is already there, it has to fit to the new blocks
+      char header[header_size];
+      if (resume_offset < header_size ||
+          std::fseek(output_, 0, SEEK_SET) != 0 ||
+          std::fread(header, 1, header_size, output_) != header_size ||
+          std::memcmp(header, magic_number, sizeof(magic_number)) != 0 ||
+          get<uint16_t>(header + 6) != flags ||
+          std::fseek(output_, 0, SEEK_END) != 0) {
+        // The file is closed by ~NucleiWriter
+        throw std::runtime_error(output_file + " is not a nuclei file of " +
+                                 "the same format, can't resume it.");
+      }
+      return;
+    }
+    std::fwrite(magic_number, 1, sizeof(magic_number), output_);
+    std::fwrite(&binary_version, sizeof(uint16_t), 1, output_);
+    std::fwrite(&flags, sizeof(uint16_t), 1, output_);
+  }
+
+  ~BinaryNucleiWriter() override {
+    // Normally flush() wrote everything before, an error can't be thrown
+    // from here
+    try {
+      flush_chunk();
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "Output to %s is incomplete: %s\n",
+                   output_file_.c_str(), e.what());
+    }
+  }
+
+  void write_event(size_t event_number,
+                   const std::vector<Particle> &nuclei) override {
+    chunk_.push_back('e');
+    put(chunk_, static_cast<uint64_t>(event_number));
+    put(chunk_, static_cast<uint32_t>(nuclei.size()));
+    for (const Particle &nucleus : nuclei) {
+      for (double x : nucleus.momentum) {
+        put(chunk_, x);
+      }
+      for (double x : nucleus.origin) {
+        put(chunk_, x);
+      }
+      put(chunk_, static_cast<int32_t>(nucleus.type));
+      put(chunk_, nucleus.pdg_mother1);
+      put(chunk_, nucleus.pdg_mother2);
+      put(chunk_, nucleus.weight);
+    }
+    if (!compress_ || chunk_.size() >= chunk_size) {
+      flush_chunk();
+    }
+  }
+
+  void append(const std::string &file) override {
+    flush_chunk();
+    FILE *input = std::fopen(file.c_str(), "rb");
+    if (input == NULL) {
+      throw std::runtime_error("Can't open file " + file);
+    }
+    // Blocks of a file with the same header can be copied as they are
+    char header[header_size];
+    const uint16_t flags = compress_ ? flag_zlib : 0;
+    if (std::fread(header, 1, header_size, input) != header_size ||
+        std::memcmp(header, magic_number, sizeof(magic_number)) != 0 ||
+        get<uint16_t>(header + 6) != flags) {
+      std::fclose(input);
+      throw std::runtime_error(file + " is not a nuclei file of the same" +
+                               " format, can't append it.");
+    }
+    copy_rest(input, file);
+    std::fclose(input);
+  }
+
+  void flush() override {
+    flush_chunk();
+    NucleiWriter::flush();
+  }
+
+ private:
+  /// Write the pending event blocks, as one compressed chunk if required
+  void flush_chunk() {
+    if (chunk_.empty()) {
+      return;
+    }
+    if (!compress_) {
+      std::fwrite(chunk_.data(), 1, chunk_.size(), output_);
+      chunk_.clear();
+      return;
+    }
+#ifdef COALESCENCE_HAVE_ZLIB
+    uLongf compressed_size = compressBound(chunk_.size());
+    compressed_.resize(compressed_size);
+    if (compress2(compressed_.data(), &compressed_size,
+                  reinterpret_cast<const Bytef *>(chunk_.data()),
+                  chunk_.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+      throw std::runtime_error("Compression of the output failed");
+    }
+    const uint32_t sizes[2] = {static_cast<uint32_t>(compressed_size),
+                               static_cast<uint32_t>(chunk_.size())};
+    std::fputc('z', output_);
+    std::fwrite(sizes, sizeof(uint32_t), 2, output_);
+    std::fwrite(compressed_.data(), 1, compressed_size, output_);
+#endif
+    chunk_.clear();
+  }
+
+  const bool compress_;
+  // Event blocks waiting to be written
+  std::vector<char> chunk_;
+  std::vector<unsigned char> compressed_;
+};
+
+}  // unnamed namespace
+
+void write_text_event(FILE *output, size_t event_number,
+                      const std::vector<Particle> &nuclei) {
+  fprintf(output, "# event %lu %lu\n", event_number, nuclei.size());
+  for (const Particle &nucleus : nuclei) {
+    const FourVector &p = nucleus.momentum;
+    fprintf(output, "%12.8f %12.8f %12.8f %12.8f %d %12.8f\n",
+        p.x0(), p.x1(), p.x2(), p.x3(), static_cast<int>(nucleus.type), nucleus.weight);
+  }
+}
+
+std::unique_ptr<NucleiWriter> NucleiWriter::create(
+    const std::string &output_file, OutputFormat format, bool compress,
+    uint64_t resume_offset) {
+  switch (format) {
+    case OutputFormat::text:
+      if (compress) {
+        throw std::runtime_error("Only binary output can be compressed.");
+      }
+      return std::unique_ptr<NucleiWriter>(
+          new TextNucleiWriter(output_file, resume_offset));
+    case OutputFormat::binary:
+      return std::unique_ptr<NucleiWriter>(
+          new BinaryNucleiWriter(output_file, compress, resume_offset));
+  }
+  throw std::runtime_error("Unknown output format");
+}
+
+NucleiWriter::NucleiWriter(const std::string &output_file,
+                           uint64_t resume_offset) :
+    output_file_(output_file) {
+  if (resume_offset == 0) {
+    output_ = std::fopen(output_file.c_str(), "wb");
+    if (output_ == NULL) {
+      throw std::runtime_error("Can't open file " + output_file);
+    }
+    return;
+  }
+  // Drop what was written after the checkpoint and continue from there
+  output_ = std::fopen(output_file.c_str(), "r+b");
+  if (output_ == NULL) {
+    throw std::runtime_error("Can't open file " + output_file +
+                             " to resume it");
+  }
+  if (std::fseek(output_, 0, SEEK_END) != 0 ||
+      static_cast<uint64_t>(ftello(output_)) < resume_offset ||
+      ftruncate(fileno(output_), static_cast<off_t>(resume_offset)) != 0 ||
+      std::fseek(output_, 0, SEEK_END) != 0) {
+    std::fclose(output_);
+    throw std::runtime_error(output_file + " is shorter than at the " +
+                             "checkpoint, can't resume it");
+  }
+}
+
+void NucleiWriter::flush() {
+  // Files like /dev/null can't be synchronized and need not be
+  if (std::fflush(output_) != 0 ||
+      (fsync(fileno(output_)) != 0 && errno != EINVAL)) {
+    throw std::runtime_error("Failed to write " + output_file_);
+  }
+}
+
+uint64_t NucleiWriter::size() const {
+  return static_cast<uint64_t>(ftello(output_));
+}
+
+NucleiWriter::~NucleiWriter() {
+  std::fclose(output_);
+}
+
+void NucleiWriter::copy_rest(FILE *input, const std::string &file) {
+  std::vector<char> buffer(1 << 20);
+  size_t n;
+  while ((n = std::fread(buffer.data(), 1, buffer.size(), input)) > 0) {
+    if (std::fwrite(buffer.data(), 1, n, output_) != n) {
+      throw std::runtime_error("Can't append " + file + " to " +
+                               output_file_);
+    }
+  }
+}
+
+BinaryNucleiReader::BinaryNucleiReader(const std::string &input_file) :
+    input_file_(input_file) {
+  input_ = std::fopen(input_file.c_str(), "rb");
+  if (input_ == NULL) {
+    throw std::runtime_error("Can't open file " + input_file);
+  }
+  char header[header_size];
+  if (std::fread(header, 1, header_size, input_) != header_size ||
+      std::memcmp(header, magic_number, sizeof(magic_number)) != 0) {
+    std::fclose(input_);
+    throw std::runtime_error(input_file + " is not a binary nuclei file.");
+  }
+  if (get<uint16_t>(header + 4) != binary_version) {
+    std::fclose(input_);
+    throw std::runtime_error(input_file + " has unknown format version.");
+  }
+  compressed_ = get<uint16_t>(header + 6) & flag_zlib;
+#ifndef COALESCENCE_HAVE_ZLIB
+  if (compressed_) {
+    std::fclose(input_);
+    throw std::runtime_error(input_file + " is compressed, but this build" +
+                             " has no zlib.");
+  }
+#endif
+}
+
+BinaryNucleiReader::~BinaryNucleiReader() {
+  std::fclose(input_);
+}
+
+bool BinaryNucleiReader::next_bytes(void *dest, size_t n) {
+  if (!compressed_) {
+    return std::fread(dest, 1, n, input_) == n;
+  }
+#ifdef COALESCENCE_HAVE_ZLIB
+  while (chunk_position_ + n > chunk_.size()) {
+    // Start the next chunk, blocks never cross chunk boundaries
+    if (chunk_position_ != chunk_.size()) {
+      throw std::runtime_error(input_file_ + " has a broken chunk.");
+    }
+    char type;
+    uint32_t sizes[2];
+    if (std::fread(&type, 1, 1, input_) != 1) {
+      return false;
+    }
+    if (type != 'z' || std::fread(sizes, sizeof(uint32_t), 2, input_) != 2) {
+      throw std::runtime_error(input_file_ + " has a broken chunk.");
+    }
+    compressed_chunk_.resize(sizes[0]);
+    chunk_.resize(sizes[1]);
+    uLongf size = sizes[1];
+    if (std::fread(compressed_chunk_.data(), 1, sizes[0], input_) !=
+            sizes[0] ||
+        uncompress(reinterpret_cast<Bytef *>(chunk_.data()), &size,
+                   compressed_chunk_.data(), sizes[0]) != Z_OK ||
+        size != sizes[1]) {
+      throw std::runtime_error(input_file_ + " has a broken chunk.");
+    }
+    chunk_position_ = 0;
+  }
+  std::memcpy(dest, chunk_.data() + chunk_position_, n);
+  chunk_position_ += n;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool BinaryNucleiReader::read_event(size_t &event_number,
+                                    std::vector<Particle> &nuclei) {
+  nuclei.clear();
+  char header[event_header_size];
+  if (!next_bytes(header, event_header_size)) {
+    return false;
+  }
+  if (header[0] != 'e') {
+    throw std::runtime_error(input_file_ + " has a broken event block.");
+  }
+  event_number = get<uint64_t>(header + 1);
+  const uint32_t n_nuclei = get<uint32_t>(header + 1 + sizeof(uint64_t));
+  char record[record_size];
+  for (uint32_t i = 0; i < n_nuclei; i++) {
+    if (!next_bytes(record, record_size)) {
+      throw std::runtime_error(input_file_ + " ends unexpectedly.");
+    }
+    const char *r = record;
+    const FourVector p(get<double>(r), get<double>(r + 8),
+                       get<double>(r + 16), get<double>(r + 24));
+    const FourVector x(get<double>(r + 32), get<double>(r + 40),
+                       get<double>(r + 48), get<double>(r + 56));
+    const ParticleType type =
+        static_cast<ParticleType>(get<int32_t>(r + 64));
+    nuclei.push_back(make_particle(p, x, type, get<int32_t>(r + 68),
+                                   get<int32_t>(r + 72), get<double>(r + 76)));
+  }
+  return true;
+}
+
+}  // namespace coalescence
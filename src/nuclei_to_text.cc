@@ -0,0 +1,38 @@
+#include "coalescence/nuclei_output.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ * Convert binary nuclei output of the coalescence afterburner to the text
+ * layout, which the afterburner writes with --format text.
+ */
+int main(int argc, char **argv) {
+  using namespace coalescence;
+  if (argc < 2 || argc > 3) {
+    std::printf("\nUsage: %s <binary nuclei file> [<text output file>]\n\n"
+                "  Text is printed to stdout, if no output file is given.\n\n",
+                argv[0]);
+    return EXIT_FAILURE;
+  }
+  BinaryNucleiReader reader(argv[1]);
+  FILE *output = stdout;
+  if (argc == 3) {
+    output = std::fopen(argv[2], "w");
+    if (output == NULL) {
+      throw std::runtime_error("Can't open file " + std::string(argv[2]));
+    }
+  }
+  size_t event_number;
+  std::vector<Particle> nuclei;
+  while (reader.read_event(event_number, nuclei)) {
+    write_text_event(output, event_number, nuclei);
+  }
+  if (output != stdout) {
+    std::fclose(output);
+  }
+}
@@ -0,0 +1,158 @@
+#include "coalescence/nucleon_store.h"
+
+#include <cmath>
+
+namespace coalescence {
+
+void NucleonStore::clear() {
+  e.clear();
+  px.clear();
+  py.clear();
+  pz.clear();
+  m2.clear();
+  t.clear();
+  x.clear();
+  y.clear();
+  z.clear();
+  valid.clear();
+  plus_f.clear();
+  minus_f.clear();
+  px_f.clear();
+  py_f.clear();
+  m2_f.clear();
+}
+
+void NucleonStore::reserve(size_t n) {
+  e.reserve(n);
+  px.reserve(n);
+  py.reserve(n);
+  pz.reserve(n);
+  m2.reserve(n);
+  t.reserve(n);
+  x.reserve(n);
+  y.reserve(n);
+  z.reserve(n);
+  valid.reserve(n);
+  plus_f.reserve(n);
+  minus_f.reserve(n);
+  px_f.reserve(n);
+  py_f.reserve(n);
+  m2_f.reserve(n);
+}
+
+void NucleonStore::push_back(const Particle &particle) {
+  const FourVector &p = particle.momentum, &r = particle.origin;
+  e.push_back(p.x0());
+  px.push_back(p.x1());
+  py.push_back(p.x2());
+  pz.push_back(p.x3());
+  m2.push_back(p.sqr());
+  t.push_back(r.x0());
+  x.push_back(r.x1());
+  y.push_back(r.x2());
+  z.push_back(r.x3());
+  valid.push_back(particle.valid);
+  plus_f.push_back(static_cast<float>(p.x0() + p.x3()));
+  minus_f.push_back(static_cast<float>(p.x0() - p.x3()));
+  px_f.push_back(static_cast<float>(p.x1()));
+  py_f.push_back(static_cast<float>(p.x2()));
+  m2_f.push_back(static_cast<float>(m2.back()));
+}
+
+void NucleonStore::select_close_momenta(const FourVector &p, double max_dp2,
+                                        size_t begin, size_t end,
+                                        std::vector<uint32_t> &positions,
+                                        AlignedVector<uint8_t> &scratch) const {
+  const size_t n = end - begin;
+  if (scratch.size() < n) {
+    scratch.resize(n);
+  }
+  const double e1 = p.x0(), px1 = p.x1(), py1 = p.x2(), pz1 = p.x3();
+  const double m1sqr = p.sqr();
+  const double *__restrict e2 = e.data() + begin;
+  const double *__restrict px2 = px.data() + begin;
+  const double *__restrict py2 = py.data() + begin;
+  const double *__restrict pz2 = pz.data() + begin;
+  const double *__restrict m2sqr = m2.data() + begin;
+  const uint8_t *__restrict valid2 = valid.data() + begin;
+  uint8_t *__restrict pass = scratch.data();
+
+  // Same invariant as Coalescence::cm_momentum_difference_sqr, written
+  // out on the arrays without branches so that the loop is vectorized.
+  // The comparison is multiplied out to avoid the division by s.
+  for (size_t k = 0; k < n; k++) {
+    const double se = e1 + e2[k], sx = px1 + px2[k],
+                 sy = py1 + py2[k], sz = pz1 + pz2[k];
+    const double s = se * se - sx * sx - sy * sy - sz * sz;
+    const double a = s - m1sqr - m2sqr[k];
+    const double lambda = a * a - 4.0 * m1sqr * m2sqr[k];
+    pass[k] = (lambda <= max_dp2 * s) & valid2[k];
+  }
+
+  for (size_t k = 0; k < n; k++) {
+    if (pass[k]) {
+      positions.push_back(static_cast<uint32_t>(begin + k));
+    }
+  }
+}
+
+void NucleonStore::prefilter_close_momenta(
+    const FourVector &p, double max_dp2, size_t begin, size_t end,
+    std::vector<uint32_t> &positions, AlignedVector<uint8_t> &scratch) const {
+  const size_t n = end - begin;
+  if (scratch.size() < n) {
+    scratch.resize(n);
+  }
+  const float plus1 = static_cast<float>(p.x0() + p.x3()),
+              minus1 = static_cast<float>(p.x0() - p.x3()),
+              px1 = static_cast<float>(p.x1()),
+              py1 = static_cast<float>(p.x2());
+  const float m1sqr = static_cast<float>(p.sqr());
+  const float quarter_dp2 = static_cast<float>(0.25 * max_dp2);
+  const float *__restrict plus2 = plus_f.data() + begin;
+  const float *__restrict minus2 = minus_f.data() + begin;
+  const float *__restrict px2 = px_f.data() + begin;
+  const float *__restrict py2 = py_f.data() + begin;
+  const float *__restrict m2sqr = m2_f.data() + begin;
+  const uint8_t *__restrict valid2 = valid.data() + begin;
+  uint8_t *__restrict pass = scratch.data();
+
+  // With the product of the four-momenta d = p1.p2 the invariant reads
+  //   lambda / 4 = d^2 - m1^2 m2^2 <= max_dp2 s / 4,
+  //   s = m1^2 + m2^2 + 2 d,
+  // which avoids the cancellations in s - m1^2 - m2^2. In light-cone
+  // components d = L - px1 px2 - py1 py2 with
+  //   L = ((E1 + pz1) (E2 - pz2) + (E1 - pz1) (E2 + pz2)) / 2,
+  // which is invariant under boosts along the beam, unlike E1 E2, so that
+  // the rounding errors do not grow with the common rapidity of the pair.
+  // With the float epsilon u = 2^-24, the inputs and the products of d are
+  // rounded by at most 3 u and |px1 px2 + py1 py2| <= L, so that d is off
+  // by less than 16 u L. This error enters lhs as 2 |d| 16 u L + (16 u L)^2
+  // and rhs as 32 u L dp2 / 4, the rounding of the remaining products and
+  // sums is below 4 u (d^2 + m1^2 m2^2 + (m1^2 + m2^2) dp2 / 4). The
+  // tolerance is four times the sum, each term scaled by what it bounds.
+  constexpr float rel = 1.0f / (1 << 17), rel_rounding = 1.0f / (1 << 20),
+                  rel_d = 1.0f / (1 << 19);
+  for (size_t k = 0; k < n; k++) {
+    const float l = 0.5f * (plus1 * minus2[k] + minus1 * plus2[k]);
+    const float d = l - px1 * px2[k] - py1 * py2[k];
+    const float mm = m1sqr * m2sqr[k];
+    const float lhs = d * d - mm;
+    const float m_sum = m1sqr + m2sqr[k];
+    const float rhs = quarter_dp2 * (m_sum + 2.0f * d);
+    const float d_error = rel_d * l;
+    const float tolerance = rel * l * (std::fabs(d) + quarter_dp2) +
+                            rel_rounding * (d * d + mm +
+                                            quarter_dp2 * m_sum) +
+                            d_error * d_error;
+    pass[k] = (lhs <= rhs + tolerance) & valid2[k];
+  }
+
+  for (size_t k = 0; k < n; k++) {
+    if (pass[k]) {
+      positions.push_back(static_cast<uint32_t>(begin + k));
+    }
+  }
+}
+
+}  // namespace coalescence
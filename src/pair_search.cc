@@ -0,0 +1,69 @@
+#include "coalescence/pair_search.h"
+
+#include <stdexcept>
+
+namespace coalescence {
+
+const char *pair_search_name(PairSearch method) {
+  switch (method) {
+    case PairSearch::grid: return "grid";
+    case PairSearch::rapidity: return "rapidity";
+    case PairSearch::brute: return "brute";
+  }
+  return "unknown";
+}
+
+PairSearch pair_search_from_name(const std::string &name) {
+  for (PairSearch method : {PairSearch::grid, PairSearch::rapidity,
+                            PairSearch::brute}) {
+    if (name == pair_search_name(method)) {
+      return method;
+    }
+  }
+  throw std::invalid_argument("Unknown pair search " + name);
+}
+
+void PairFinder::build(const std::vector<Particle> &particles, double deltap,
+                       PairSearch method) {
+  method_ = method;
+  if (method_ == PairSearch::grid) {
+    const double m = MomentumGrid::min_mass(particles);
+    grid_.build(particles, MomentumGrid::max_distance(m, m, deltap));
+  } else {
+    sweep_.build(particles);
+  }
+}
+
+void PairFinder::find_candidates(const FourVector &p, double deltap,
+                                 std::vector<size_t> &candidates) {
+  switch (method_) {
+    case PairSearch::grid:
+      grid_.find_candidates(p, deltap, candidates);
+      break;
+    case PairSearch::rapidity:
+      sweep_.find_candidates(p, deltap, candidates);
+      break;
+    case PairSearch::brute:
+      sweep_.find_all_candidates(p, deltap, candidates);
+      break;
+  }
+}
+
+void PairFinder::invalidate(size_t i) {
+  if (method_ == PairSearch::grid) {
+    grid_.invalidate(i);
+  } else {
+    sweep_.invalidate(i);
+  }
+}
+
+size_t PairFinder::memory_size() const {
+  return grid_.memory_size() + sweep_.memory_size();
+}
+
+void PairFinder::reserve_like(const PairFinder &other, double factor) {
+  grid_.reserve_like(other.grid_, factor);
+  sweep_.reserve_like(other.sweep_, factor);
+}
+
+}  // namespace coalescence
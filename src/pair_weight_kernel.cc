@@ -0,0 +1,80 @@
+#include "coalescence/pair_weight_kernel.h"
+
+#include <cmath>
+
+#include "pair_weight_kernel_impl.h"
+
+namespace coalescence {
+
+namespace {
+
+/// Pack of one double, the fallback for any CPU
+struct Scalar {
+  static const size_t width = 1;
+  typedef uint32_t Index;
+  double v;
+
+  Scalar() = default;
+  explicit Scalar(double a) : v(a) {}
+  static Index load_index(const uint32_t *positions) { return positions[0]; }
+  static Scalar gather(const double *base, Index i) { return Scalar(base[i]); }
+  void store(double *dest) const { dest[0] = v; }
+
+  static Scalar sqrt(Scalar a) { return Scalar(std::sqrt(a.v)); }
+  static Scalar min(Scalar a, Scalar b) { return Scalar(a.v < b.v ? a.v : b.v); }
+  static Scalar max(Scalar a, Scalar b) { return Scalar(a.v > b.v ? a.v : b.v); }
+  static Scalar exp(Scalar a) { return Scalar(std::exp(a.v)); }
+};
+
+inline Scalar operator+(Scalar a, Scalar b) { return Scalar(a.v + b.v); }
+inline Scalar operator-(Scalar a, Scalar b) { return Scalar(a.v - b.v); }
+inline Scalar operator*(Scalar a, Scalar b) { return Scalar(a.v * b.v); }
+inline Scalar operator/(Scalar a, Scalar b) { return Scalar(a.v / b.v); }
+
+}  // unnamed namespace
+
+void pair_weights_scalar(const PairWeightBatch &batch) {
+  pair_weight_kernel<Scalar>(batch);
+}
+
+SimdLevel best_simd_level() {
+#ifdef COALESCENCE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SimdLevel::avx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::avx2;
+  }
+#endif
+  return SimdLevel::scalar;
+}
+
+const char *simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::scalar: return "scalar";
+    case SimdLevel::avx2: return "AVX2";
+    case SimdLevel::avx512: return "AVX-512";
+  }
+  return "unknown";
+}
+
+void pair_weights(SimdLevel level, const FourVector &p, const FourVector &r,
+                  const NucleonStore &partners, const uint32_t *positions,
+                  size_t n, double d2, double hbarc, double *weights) {
+  const PairWeightBatch batch = {
+      {p.x0(), p.x1(), p.x2(), p.x3()}, {r.x0(), r.x1(), r.x2(), r.x3()},
+      partners.e.data(), partners.px.data(), partners.py.data(),
+      partners.pz.data(), partners.t.data(), partners.x.data(),
+      partners.y.data(), partners.z.data(),
+      positions, n, d2, hbarc, weights};
+  switch (level) {
+#ifdef COALESCENCE_X86_KERNELS
+    case SimdLevel::avx512: pair_weights_avx512(batch); break;
+    case SimdLevel::avx2: pair_weights_avx2(batch); break;
+#endif
+    default: pair_weights_scalar(batch);
+  }
+}
+
+}  // namespace coalescence
@@ -0,0 +1,59 @@
+// Compiled with -mavx2 -mfma, only called if the CPU supports both
+#include <immintrin.h>
+
+// GCC reports the intentionally undefined registers inside of the
+// intrinsics (_mm*_undefined_pd) as maybe uninitialized
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+#include "pair_weight_kernel_impl.h"
+
+namespace coalescence {
+
+namespace {
+
+/// Pack of 4 doubles in an AVX2 register
+struct Avx2 {
+  static const size_t width = 4;
+  typedef __m128i Index;
+  __m256d v;
+
+  Avx2() = default;
+  explicit Avx2(double a) : v(_mm256_set1_pd(a)) {}
+  explicit Avx2(__m256d a) : v(a) {}
+  static Index load_index(const uint32_t *positions) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(positions));
+  }
+  static Avx2 gather(const double *base, Index i) {
+    return Avx2(_mm256_i32gather_pd(base, i, 8));
+  }
+  void store(double *dest) const { _mm256_storeu_pd(dest, v); }
+
+  static Avx2 sqrt(Avx2 a) { return Avx2(_mm256_sqrt_pd(a.v)); }
+  static Avx2 min(Avx2 a, Avx2 b) { return Avx2(_mm256_min_pd(a.v, b.v)); }
+  static Avx2 max(Avx2 a, Avx2 b) { return Avx2(_mm256_max_pd(a.v, b.v)); }
+  static Avx2 round(Avx2 a) {
+    return Avx2(_mm256_round_pd(a.v,
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+  /// a * 2^n for integer valued n, built directly in the exponent bits
+  static Avx2 scale_pow2(Avx2 a, Avx2 n) {
+    const __m256i n64 = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n.v));
+    const __m256i bits = _mm256_slli_epi64(
+        _mm256_add_epi64(n64, _mm256_set1_epi64x(1023)), 52);
+    return Avx2(_mm256_mul_pd(a.v, _mm256_castsi256_pd(bits)));
+  }
+  static Avx2 exp(Avx2 a) { return exp_poly(a); }
+};
+
+inline Avx2 operator+(Avx2 a, Avx2 b) { return Avx2(_mm256_add_pd(a.v, b.v)); }
+inline Avx2 operator-(Avx2 a, Avx2 b) { return Avx2(_mm256_sub_pd(a.v, b.v)); }
+inline Avx2 operator*(Avx2 a, Avx2 b) { return Avx2(_mm256_mul_pd(a.v, b.v)); }
+inline Avx2 operator/(Avx2 a, Avx2 b) { return Avx2(_mm256_div_pd(a.v, b.v)); }
+
+}  // unnamed namespace
+
+void pair_weights_avx2(const PairWeightBatch &batch) {
+  pair_weight_kernel<Avx2>(batch);
+}
+
+}  // namespace coalescence
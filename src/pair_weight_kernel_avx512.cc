@@ -0,0 +1,68 @@
+// Compiled with -mavx512f, only called if the CPU supports it
+#include <immintrin.h>
+
+// GCC reports the intentionally undefined registers inside of the
+// intrinsics (_mm*_undefined_pd) as maybe uninitialized
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+#include "pair_weight_kernel_impl.h"
+
+namespace coalescence {
+
+namespace {
+
+/// Pack of 8 doubles in an AVX-512 register
+struct Avx512 {
+  static const size_t width = 8;
+  typedef __m256i Index;
+  __m512d v;
+
+  Avx512() = default;
+  explicit Avx512(double a) : v(_mm512_set1_pd(a)) {}
+  explicit Avx512(__m512d a) : v(a) {}
+  static Index load_index(const uint32_t *positions) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(positions));
+  }
+  static Avx512 gather(const double *base, Index i) {
+    return Avx512(_mm512_i32gather_pd(i, base, 8));
+  }
+  void store(double *dest) const { _mm512_storeu_pd(dest, v); }
+
+  static Avx512 sqrt(Avx512 a) { return Avx512(_mm512_sqrt_pd(a.v)); }
+  static Avx512 min(Avx512 a, Avx512 b) {
+    return Avx512(_mm512_min_pd(a.v, b.v));
+  }
+  static Avx512 max(Avx512 a, Avx512 b) {
+    return Avx512(_mm512_max_pd(a.v, b.v));
+  }
+  static Avx512 round(Avx512 a) {
+    return Avx512(_mm512_roundscale_pd(
+        a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+  /// a * 2^n for integer valued n
+  static Avx512 scale_pow2(Avx512 a, Avx512 n) {
+    return Avx512(_mm512_scalef_pd(a.v, n.v));
+  }
+  static Avx512 exp(Avx512 a) { return exp_poly(a); }
+};
+
+inline Avx512 operator+(Avx512 a, Avx512 b) {
+  return Avx512(_mm512_add_pd(a.v, b.v));
+}
+inline Avx512 operator-(Avx512 a, Avx512 b) {
+  return Avx512(_mm512_sub_pd(a.v, b.v));
+}
+inline Avx512 operator*(Avx512 a, Avx512 b) {
+  return Avx512(_mm512_mul_pd(a.v, b.v));
+}
+inline Avx512 operator/(Avx512 a, Avx512 b) {
+  return Avx512(_mm512_div_pd(a.v, b.v));
+}
+
+}  // unnamed namespace
+
+void pair_weights_avx512(const PairWeightBatch &batch) {
+  pair_weight_kernel<Avx512>(batch);
+}
+
+}  // namespace coalescence
@@ -0,0 +1,152 @@
+#ifndef COALESCENCE_PAIR_WEIGHT_KERNEL_IMPL_H
+#define COALESCENCE_PAIR_WEIGHT_KERNEL_IMPL_H
+
+/*
+ * Implementation of the batched pair weight kernel, shared by the
+ * translation units compiled for different instruction sets.
+ *
+ * The kernel is written once as a template over a SIMD pack type V, that
+ * provides arithmetic operators, sqrt, max, exp, gather and store. Every
+ * translation unit defines its pack types in an unnamed namespace, so that
+ * code compiled with different instruction sets never gets merged by the
+ * linker. For the same reason only raw pointers cross the boundary.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace coalescence {
+
+/// Input and output of one batch, see coalescence::pair_weights
+struct PairWeightBatch {
+  double p[4], r[4];
+  const double *e, *px, *py, *pz, *t, *x, *y, *z;
+  const uint32_t *positions;
+  size_t n;
+  double d2, hbarc;
+  double *weights;
+};
+
+void pair_weights_scalar(const PairWeightBatch &batch);
+void pair_weights_avx2(const PairWeightBatch &batch);
+void pair_weights_avx512(const PairWeightBatch &batch);
+
+namespace {
+
+/**
+ * Lorentz boost of (a0, a) with velocity v, gamma and
+ * g1 = gamma / (gamma + 1), as in FourVector::lorentz_boost
+ */
+template <typename V>
+inline void boost(const V &vx, const V &vy, const V &vz,
+                  const V &gamma, const V &g1,
+                  const V &a0, const V &ax, const V &ay, const V &az,
+                  V &b0, V &bx, V &by, V &bz) {
+  b0 = gamma * (a0 - (ax * vx + ay * vy + az * vz));
+  const V constantpart = g1 * (b0 + a0);
+  bx = ax - vx * constantpart;
+  by = ay - vy * constantpart;
+  bz = az - vz * constantpart;
+}
+
+/**
+ * exp(x) from the reduction x = n ln2 + r, |r| <= ln2 / 2, and a Taylor
+ * polynomial of degree 11 for exp(r), relative error below 1e-14.
+ */
+template <typename V>
+inline V exp_poly(V x) {
+  x = V::min(V::max(x, V(-708.0)), V(709.0));
+  const V n = V::round(x * V(1.4426950408889634));
+  const V r = (x - n * V(0.693145751953125)) - n * V(1.42860682030941723212e-6);
+  V poly(1.0 / 39916800.0);
+  poly = poly * r + V(1.0 / 3628800.0);
+  poly = poly * r + V(1.0 / 362880.0);
+  poly = poly * r + V(1.0 / 40320.0);
+  poly = poly * r + V(1.0 / 5040.0);
+  poly = poly * r + V(1.0 / 720.0);
+  poly = poly * r + V(1.0 / 120.0);
+  poly = poly * r + V(1.0 / 24.0);
+  poly = poly * r + V(1.0 / 6.0);
+  poly = poly * r + V(0.5);
+  poly = poly * r + V(1.0);
+  poly = poly * r + V(1.0);
+  return V::scale_pow2(poly, n);
+}
+
+/// Weights of the pairs in one pack, see Coalescence::get_pair_weight
+template <typename V>
+inline V pair_weight_pack(const PairWeightBatch &b,
+                          const V &e2, const V &px2, const V &py2,
+                          const V &pz2, const V &t2, const V &x2,
+                          const V &y2, const V &z2) {
+  const V e1(b.p[0]), px1(b.p[1]), py1(b.p[2]), pz1(b.p[3]);
+  const V t1(b.r[0]), x1(b.r[1]), y1(b.r[2]), z1(b.r[3]);
+  const V one(1.0);
+
+  // 1. Boost to the center of mass frame
+  const V inv_e = one / (e1 + e2);
+  const V vx = (px1 + px2) * inv_e, vy = (py1 + py2) * inv_e,
+          vz = (pz1 + pz2) * inv_e;
+  const V gamma = one / V::sqrt(one - (vx * vx + vy * vy + vz * vz));
+  const V g1 = gamma / (gamma + one);
+  V pe1, ppx1, ppy1, ppz1, pe2, ppx2, ppy2, ppz2,
+    rt1, rx1, ry1, rz1, rt2, rx2, ry2, rz2;
+  boost(vx, vy, vz, gamma, g1, e1, px1, py1, pz1, pe1, ppx1, ppy1, ppz1);
+  boost(vx, vy, vz, gamma, g1, e2, px2, py2, pz2, pe2, ppx2, ppy2, ppz2);
+  boost(vx, vy, vz, gamma, g1, t1, x1, y1, z1, rt1, rx1, ry1, rz1);
+  boost(vx, vy, vz, gamma, g1, t2, x2, y2, z2, rt2, rx2, ry2, rz2);
+
+  // 2. Get momentum difference, 0.25 because q = |p1-p2|/2
+  const V dpx = ppx1 - ppx2, dpy = ppy1 - ppy2, dpz = ppz1 - ppz2;
+  const V dp2 = (dpx * dpx + dpy * dpy + dpz * dpz) * V(0.25);
+
+  // 3. Roll to the time, when the last hadron was born
+  const V tmax = V::max(rt1, rt2);
+  const V dt1 = (tmax - rt1) * (one / pe1), dt2 = (tmax - rt2) * (one / pe2);
+  const V drx = (rx1 + dt1 * ppx1) - (rx2 + dt2 * ppx2),
+          dry = (ry1 + dt1 * ppy1) - (ry2 + dt2 * ppy2),
+          drz = (rz1 + dt1 * ppz1) - (rz2 + dt2 * ppz2);
+
+  // 4. Get spatial distance
+  const V dr2 = drx * drx + dry * dry + drz * drz;
+
+  const V d2(b.d2);
+  return V(3.0) * V::exp(V(0.0) - dr2 / d2 -
+                         dp2 * d2 / V(b.hbarc * b.hbarc));
+}
+
+/// Run the kernel over the whole batch, the last partial pack is padded
+template <typename V>
+inline void pair_weight_kernel(const PairWeightBatch &b) {
+  const size_t width = V::width;
+  size_t k = 0;
+  for (; k + width <= b.n; k += width) {
+    const typename V::Index idx = V::load_index(b.positions + k);
+    pair_weight_pack<V>(b, V::gather(b.e, idx), V::gather(b.px, idx),
+                        V::gather(b.py, idx), V::gather(b.pz, idx),
+                        V::gather(b.t, idx), V::gather(b.x, idx),
+                        V::gather(b.y, idx), V::gather(b.z, idx))
+        .store(b.weights + k);
+  }
+  if (k < b.n) {
+    uint32_t positions[V::width];
+    double weights[V::width];
+    for (size_t l = 0; l < width; l++) {
+      positions[l] = b.positions[k + l < b.n ? k + l : b.n - 1];
+    }
+    const typename V::Index idx = V::load_index(positions);
+    pair_weight_pack<V>(b, V::gather(b.e, idx), V::gather(b.px, idx),
+                        V::gather(b.py, idx), V::gather(b.pz, idx),
+                        V::gather(b.t, idx), V::gather(b.x, idx),
+                        V::gather(b.y, idx), V::gather(b.z, idx))
+        .store(weights);
+    for (size_t l = 0; k + l < b.n; l++) {
+      b.weights[k + l] = weights[l];
+    }
+  }
+}
+
+}  // unnamed namespace
+}  // namespace coalescence
+
+#endif  // COALESCENCE_PAIR_WEIGHT_KERNEL_IMPL_H
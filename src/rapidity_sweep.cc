@@ -0,0 +1,95 @@
+#include "coalescence/rapidity_sweep.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "coalescence/momentum_grid.h"
+
+namespace coalescence {
+
+namespace {
+// Relative and absolute safety margins of the window against rounding
+constexpr double margin = 1e-6;
+constexpr double y_margin = 1e-9;
+}  // unnamed namespace
+
+double RapiditySweep::max_rapidity_difference(double m1, double m2,
+                                              double deltap) {
+  if (m1 <= 0.0 || m2 <= 0.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return std::acosh(MomentumGrid::max_relative_gamma(m1, m2, deltap)) *
+         (1.0 + margin) + y_margin;
+}
+
+void RapiditySweep::build(const std::vector<Particle> &particles) {
+  const size_t N = particles.size();
+  min_mass_ = MomentumGrid::min_mass(particles);
+  index_.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    index_[i] = i;
+  }
+  std::sort(index_.begin(), index_.end(), [&](size_t a, size_t b) {
+    return particles[a].kin.rapidity < particles[b].kin.rapidity;
+  });
+  rapidity_.resize(N);
+  position_.resize(N);
+  nucleons_.clear();
+  nucleons_.reserve(N);
+  for (size_t pos = 0; pos < N; pos++) {
+    const Particle &particle = particles[index_[pos]];
+    rapidity_[pos] = particle.kin.rapidity;
+    position_[index_[pos]] = pos;
+    nucleons_.push_back(particle);
+  }
+}
+
+void RapiditySweep::select(const FourVector &p, double deltap,
+                           size_t begin, size_t end,
+                           std::vector<size_t> &candidates) {
+  candidates.clear();
+  positions_.clear();
+  const double max_dp2 = deltap * deltap * (1.0 + margin);
+  nucleons_.prefilter_close_momenta(p, max_dp2, begin, end,
+                                    positions_, scratch_);
+  for (uint32_t pos : positions_) {
+    candidates.push_back(index_[pos]);
+  }
+  std::sort(candidates.begin(), candidates.end());
+}
+
+void RapiditySweep::find_candidates(const FourVector &p, double deltap,
+                                    std::vector<size_t> &candidates) {
+  const double m = std::sqrt(std::max(p.sqr(), 0.0));
+  const double dy = max_rapidity_difference(m, min_mass_, deltap);
+  const double y = 0.5 * std::log((p[0] + p[3]) / (p[0] - p[3]));
+  const size_t begin = std::lower_bound(rapidity_.begin(), rapidity_.end(),
+                                        y - dy) - rapidity_.begin();
+  const size_t end = std::upper_bound(rapidity_.begin(), rapidity_.end(),
+                                      y + dy) - rapidity_.begin();
+  select(p, deltap, begin, std::max(begin, end), candidates);
+}
+
+void RapiditySweep::find_all_candidates(const FourVector &p, double deltap,
+                                        std::vector<size_t> &candidates) {
+  select(p, deltap, 0, rapidity_.size(), candidates);
+}
+
+size_t RapiditySweep::memory_size() const {
+  return rapidity_.capacity() * sizeof(double) +
+         (index_.capacity() + position_.capacity()) * sizeof(size_t) +
+         positions_.capacity() * sizeof(uint32_t) + scratch_.capacity() +
+         nucleons_.memory_size();
+}
+
+void RapiditySweep::reserve_like(const RapiditySweep &other, double factor) {
+  rapidity_.reserve(scaled_capacity(other.rapidity_.capacity(), factor));
+  nucleons_.reserve(scaled_capacity(other.nucleons_.capacity(), factor));
+  index_.reserve(scaled_capacity(other.index_.capacity(), factor));
+  position_.reserve(scaled_capacity(other.position_.capacity(), factor));
+  positions_.reserve(scaled_capacity(other.positions_.capacity(), factor));
+  scratch_.reserve(scaled_capacity(other.scratch_.capacity(), factor));
+}
+
+}  // namespace coalescence
@@ -0,0 +1,168 @@
+#include "coalescence/smash_binary_reader.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <sys/types.h>
+
+namespace coalescence {
+
+namespace {
+
+namespace offset = smash_record::offset;
+
+template <typename T>
+inline T field(const char *record, size_t field_offset) {
+  T value;
+  std::memcpy(&value, record + field_offset, sizeof(T));
+  return value;
+}
+
+struct SmashParticleRecord {
+  double t, x, y, z, m, p0, px, py, pz,
+         form_time, xsecfac, time_last_coll;
+  int32_t pdg, id, charge, ncoll, proc_id_origin,
+          proc_type_origin, pdg_mother1, pdg_mother2;
+};
+
+SmashParticleRecord decode(const char *record) {
+  SmashParticleRecord r;
+  r.t = field<double>(record, offset::t);
+  r.x = field<double>(record, offset::x);
+  r.y = field<double>(record, offset::y);
+  r.z = field<double>(record, offset::z);
+  r.m = field<double>(record, offset::m);
+  r.p0 = field<double>(record, offset::p0);
+  r.px = field<double>(record, offset::px);
+  r.py = field<double>(record, offset::py);
+  r.pz = field<double>(record, offset::pz);
+  r.pdg = field<int32_t>(record, offset::pdg);
+  r.id = field<int32_t>(record, offset::id);
+  r.charge = field<int32_t>(record, offset::charge);
+  r.ncoll = field<int32_t>(record, offset::ncoll);
+  r.form_time = field<double>(record, offset::form_time);
+  r.xsecfac = field<double>(record, offset::xsecfac);
+  r.proc_id_origin = field<int32_t>(record, offset::proc_id_origin);
+  r.proc_type_origin = field<int32_t>(record, offset::proc_type_origin);
+  r.time_last_coll = field<double>(record, offset::time_last_coll);
+  r.pdg_mother1 = field<int32_t>(record, offset::pdg_mother1);
+  r.pdg_mother2 = field<int32_t>(record, offset::pdg_mother2);
+  return r;
+}
+
+}  // unnamed namespace
+
+constexpr size_t SmashBinaryReader::record_size;
+
+SmashBinaryReader::SmashBinaryReader(const std::string &input_file) :
+    input_file_(input_file),
+    stdio_buffer_(1 << 20),
+    input_(std::fopen(input_file.c_str(), "rb"), &std::fclose) {
+  if (input_ == nullptr) {
+    throw std::runtime_error("Can't open file " + input_file);
+  }
+  std::setvbuf(input_.get(), stdio_buffer_.data(), _IOFBF,
+               stdio_buffer_.size());
+
+  // Read header
+  char magic_number[5];
+  uint32_t len;
+  read_bytes(&magic_number[0], 4);
+  magic_number[4] = '\x00';
+  if (strcmp(magic_number, "SMSH") != 0) {
+    throw std::runtime_error(input_file + " is likely not a SMASH binary:" +
+                             " magic number does not match ");
+  }
+  read_bytes(&format_version_, sizeof(std::uint16_t));
+  read_bytes(&format_variant_, sizeof(std::uint16_t));
+  read_bytes(&len, sizeof(std::uint32_t));
+  smash_version_.resize(len);
+  read_bytes(&smash_version_[0], len);
+
+  if (format_variant_ != 1) {
+    throw std::runtime_error(input_file + " is not a file of" +
+                             " extended SMASH binary format.");
+  }
+}
+
+void SmashBinaryReader::read_bytes(void *dest, size_t n) {
+  if (std::fread(dest, 1, n, input_.get()) != n) {
+    throw std::runtime_error(input_file_ + " ends unexpectedly.");
+  }
+}
+
+size_t SmashBinaryReader::count_events(const std::string &input_file) {
+  SmashBinaryReader reader(input_file);
+  size_t n_events = 0;
+  char block_type;
+  while (std::fread(&block_type, sizeof(char), 1, reader.input_.get())) {
+    if (block_type == 'f') {
+      const long event_end_size = sizeof(std::uint32_t) + sizeof(double) +
+                                  (reader.format_version_ > 6 ? 1 : 0);
+      if (std::fseek(reader.input_.get(), event_end_size, SEEK_CUR) != 0) {
+        break;
+      }
+      n_events++;
+    } else if (block_type == 'p') {
+      uint32_t n_part_lines;
+      reader.read_bytes(&n_part_lines, sizeof(std::uint32_t));
+      if (fseeko(reader.input_.get(),
+                 static_cast<off_t>(n_part_lines) * record_size,
+                 SEEK_CUR) != 0) {
+        break;
+      }
+    } else {
+      break;
+    }
+  }
+  return n_events;
+}
+
+SmashBinaryReader::Block SmashBinaryReader::read_block(
+    std::vector<Particle> &hadrons) {
+  char block_type;
+  if (!std::fread(&block_type, sizeof(char), 1, input_.get())) {
+    return Block::end_of_input;
+  }
+  if (block_type == 'f') {
+    read_bytes(&event_, sizeof(std::uint32_t));
+    read_bytes(&impact_parameter_, sizeof(double));
+    if (format_version_ > 6) {
+      char empty;
+      read_bytes(&empty, sizeof(char));
+    }
+    return Block::event_end;
+  }
+  if (block_type != 'p') {
+    return Block::end_of_input;
+  }
+
+  uint32_t n_part_lines;
+  read_bytes(&n_part_lines, sizeof(std::uint32_t));
+  buffer_.resize(static_cast<size_t>(n_part_lines) * record_size);
+  read_bytes(buffer_.data(), buffer_.size());
+
+  size_t n_kept = 0;
+  for (size_t i = 0; i < n_part_lines; i++) {
+    const char *record = buffer_.data() + i * record_size;
+    // Most of the hadrons are not interesting, decide by the pdg code
+    // before decoding the rest of the record
+    const ParticleType hadron_type =
+        pdg_to_type(field<int32_t>(record, offset::pdg));
+    if (hadron_type == ParticleType::boring) {
+      continue;
+    }
+    const SmashParticleRecord r = decode(record);
+    FourVector p(r.p0, r.px, r.py, r.pz);
+    const Kinematics kin = kinematics_of(p);
+    FourVector origin(r.time_last_coll,
+        ThreeVector(r.x, r.y, r.z) - (r.t - r.time_last_coll) * kin.velocity);
+    hadrons.push_back({p, origin, hadron_type,
+                       r.pdg_mother1, r.pdg_mother2, 1.0, true, kin});
+    n_kept++;
+  }
+  n_kept_ += n_kept;
+  n_skipped_ += n_part_lines - n_kept;
+  return Block::particles;
+}
+
+}  // namespace coalescence
@@ -0,0 +1,233 @@
+#include "coalescence/synthetic_smash.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "coalescence/smash_record_layout.h"
+
+namespace coalescence {
+
+namespace {
+
+namespace offset = smash_record::offset;
+
+// Mothers of every hadron, a decay of a Delta into a nucleon and a pion
+constexpr int32_t pdg_mother1 = 2214, pdg_mother2 = 0;
+
+struct Species {
+  int32_t pdg;
+  double mass;
+  int32_t charge;
+};
+
+const Species proton = {2212, 0.938, 1}, neutron = {2112, 0.938, 0},
+              antiproton = {-2212, 0.938, -1},
+              antineutron = {-2112, 0.938, 0},
+              lambda = {3122, 1.116, 0}, sigma0 = {3212, 1.189, 0},
+              pi_plus = {211, 0.138, 1}, pi_minus = {-211, 0.138, -1},
+              pi_zero = {111, 0.135, 0}, k_plus = {321, 0.494, 1},
+              k_minus = {-321, 0.494, -1};
+
+template <typename T>
+inline void put(char *record, size_t field_offset, T value) {
+  std::memcpy(record + field_offset, &value, sizeof(T));
+}
+
+template <typename T>
+inline void write_value(FILE *output, const T &value) {
+  std::fwrite(&value, sizeof(T), 1, output);
+}
+
+int32_t charge_of(int32_t pdg) {
+  for (const Species &s : {proton, neutron, antiproton, antineutron,
+                           lambda, sigma0, pi_plus, pi_minus, pi_zero,
+                           k_plus, k_minus}) {
+    if (s.pdg == pdg) {
+      return s.charge;
+    }
+  }
+  return 0;
+}
+
+}  // unnamed namespace
+
+SyntheticSmashGenerator::SyntheticSmashGenerator(
+    const SyntheticEventConfig &config) : config_(config), rng_(config.seed) {
+  const double baryons = config.nucleon_fraction +
+      config.antinucleon_fraction + config.hyperon_fraction;
+  if (config.nucleon_fraction < 0.0 || config.antinucleon_fraction < 0.0 ||
+      config.hyperon_fraction < 0.0 || baryons > 1.0) {
+    throw std::invalid_argument("Fractions of hadron species should be "
+                                "non-negative and add up to at most 1");
+  }
+  if (!(config.temperature > 0.0) || config.rapidity_width < 0.0 ||
+      config.radius < 0.0 || !(config.tau > 0.0) ||
+      config.tau_spread < 0.0 || config.max_impact_parameter < 0.0) {
+    throw std::invalid_argument("Invalid parameters of synthetic events");
+  }
+  if (config.format_version < 6) {
+    throw std::invalid_argument("Synthetic SMASH output needs a format "
+                                "version of at least 6");
+  }
+}
+
+double SyntheticSmashGenerator::thermal_momentum(double m) {
+  // Rejection sampling of p^2 exp(-(E - m) / T) from a uniform momentum
+  // up to far in the tail. The maximum of the density is at
+  // p^2 = 2 E T, i.e. E = T + sqrt(T^2 + m^2).
+  const double T = config_.temperature;
+  const double e_peak = T + std::sqrt(T * T + m * m);
+  const double p_peak = std::sqrt(e_peak * e_peak - m * m);
+  const double f_peak = p_peak * p_peak * std::exp(-(e_peak - m) / T);
+  std::uniform_real_distribution<double> momentum(0.0, p_peak + 30.0 * T),
+                                         unit(0.0, 1.0);
+  while (true) {
+    const double p = momentum(rng_);
+    const double f = p * p * std::exp(-(std::sqrt(p * p + m * m) - m) / T);
+    if (unit(rng_) * f_peak <= f) {
+      return p;
+    }
+  }
+}
+
+void SyntheticSmashGenerator::generate_event(
+    std::vector<SyntheticHadron> &hadrons, double &impact_parameter) {
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::normal_distribution<double> transverse(0.0, config_.radius);
+  hadrons.clear();
+  hadrons.reserve(config_.multiplicity);
+  impact_parameter = config_.max_impact_parameter * std::sqrt(unit(rng_));
+  for (size_t i = 0; i < config_.multiplicity; i++) {
+    // Species
+    double u = unit(rng_);
+    const bool first_half = unit(rng_) < 0.5;
+    Species s;
+    if ((u -= config_.nucleon_fraction) < 0.0) {
+      s = first_half ? proton : neutron;
+    } else if ((u -= config_.antinucleon_fraction) < 0.0) {
+      s = first_half ? antiproton : antineutron;
+    } else if ((u -= config_.hyperon_fraction) < 0.0) {
+      s = unit(rng_) < 2.0 / 3.0 ? lambda : sigma0;
+    } else if (unit(rng_) < 0.1) {
+      s = first_half ? k_plus : k_minus;
+    } else {
+      const double c = 3.0 * unit(rng_);
+      s = c < 1.0 ? pi_plus : (c < 2.0 ? pi_minus : pi_zero);
+    }
+
+    // Isotropic Boltzmann momentum in the cell, boosted with the cell
+    // along the beam
+    const double p = thermal_momentum(s.mass);
+    const double cos_theta = 2.0 * unit(rng_) - 1.0;
+    const double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+    const double phi = 2.0 * M_PI * unit(rng_);
+    const double e = std::sqrt(p * p + s.mass * s.mass);
+    const double pz = p * cos_theta;
+    const double y = config_.rapidity_width * (2.0 * unit(rng_) - 1.0);
+    const FourVector momentum(e * std::cosh(y) + pz * std::sinh(y),
+                              p * sin_theta * std::cos(phi),
+                              p * sin_theta * std::sin(phi),
+                              pz * std::cosh(y) + e * std::sinh(y));
+
+    // Bjorken correlation of the space-time rapidity with the one of the
+    // cell
+    const double tau = config_.tau + config_.tau_spread * unit(rng_);
+    const FourVector origin(tau * std::cosh(y), transverse(rng_),
+                            transverse(rng_), tau * std::sinh(y));
+    hadrons.push_back({s.pdg, s.mass, momentum, origin});
+  }
+}
+
+void SyntheticSmashGenerator::write(const std::string &file) {
+  FILE *output = std::fopen(file.c_str(), "wb");
+  if (output == NULL) {
+    throw std::runtime_error("Can't open file " + file);
+  }
+  const std::string smash_version = "SMASH-synthetic";
+  std::fwrite("SMSH", 1, 4, output);
+  write_value(output, config_.format_version);
+  write_value(output, static_cast<uint16_t>(1));  // extended format
+  write_value(output, static_cast<uint32_t>(smash_version.size()));
+  std::fwrite(smash_version.data(), 1, smash_version.size(), output);
+
+  std::vector<SyntheticHadron> hadrons;
+  std::vector<char> records;
+  for (size_t event = 0; event < config_.n_events; event++) {
+    double impact_parameter;
+    generate_event(hadrons, impact_parameter);
+    records.assign(hadrons.size() * smash_record::size, 0);
+    for (size_t i = 0; i < hadrons.size(); i++) {
+      const SyntheticHadron &h = hadrons[i];
+      char *record = &records[i * smash_record::size];
+      put(record, offset::t, h.origin.x0());
+      put(record, offset::x, h.origin.x1());
+      put(record, offset::y, h.origin.x2());
+      put(record, offset::z, h.origin.x3());
+      put(record, offset::m, h.mass);
+      put(record, offset::p0, h.momentum.x0());
+      put(record, offset::px, h.momentum.x1());
+      put(record, offset::py, h.momentum.x2());
+      put(record, offset::pz, h.momentum.x3());
+      put(record, offset::pdg, h.pdg);
+      put(record, offset::id, static_cast<int32_t>(i));
+      put(record, offset::charge, charge_of(h.pdg));
+      put(record, offset::ncoll, static_cast<int32_t>(1));
+      put(record, offset::form_time, 0.0);
+      put(record, offset::xsecfac, 1.0);
+      put(record, offset::proc_id_origin, static_cast<int32_t>(i));
+      put(record, offset::proc_type_origin, static_cast<int32_t>(5));
+      put(record, offset::time_last_coll, h.origin.x0());
+      put(record, offset::pdg_mother1, pdg_mother1);
+      put(record, offset::pdg_mother2, pdg_mother2);
+    }
+    std::fputc('p', output);
+    write_value(output, static_cast<uint32_t>(hadrons.size()));
+    std::fwrite(records.data(), 1, records.size(), output);
+    std::fputc('f', output);
+    write_value(output, static_cast<uint32_t>(event));
+    write_value(output, impact_parameter);
+    if (config_.format_version > 6) {
+      std::fputc(0, output);  // the event was not empty
+    }
+  }
+  const bool failed = std::ferror(output) != 0;
+  if (std::fclose(output) != 0 || failed) {
+    throw std::runtime_error("Failed to write " + file);
+  }
+}
+
+std::vector<Particle> SyntheticSmashGenerator::to_particles(
+    const std::vector<SyntheticHadron> &hadrons) {
+  std::vector<Particle> particles;
+  for (const SyntheticHadron &h : hadrons) {
+    const ParticleType type = pdg_to_type(h.pdg);
+    if (type != ParticleType::boring) {
+      particles.push_back(make_particle(h.momentum, h.origin, type,
+                                        pdg_mother1, pdg_mother2, 1.0));
+    }
+  }
+  return particles;
+}
+
+std::vector<Particle> SyntheticSmashGenerator::event_particles(
+    const SyntheticEventConfig &config) {
+  SyntheticSmashGenerator generator(config);
+  std::vector<SyntheticHadron> hadrons;
+  double impact_parameter;
+  generator.generate_event(hadrons, impact_parameter);
+  return to_particles(hadrons);
+}
+
+std::vector<Particle> SyntheticSmashGenerator::nucleons(size_t n,
+                                                        uint64_t seed) {
+  SyntheticEventConfig config;
+  config.multiplicity = n;
+  config.nucleon_fraction = 1.0;
+  config.hyperon_fraction = 0.0;
+  config.seed = seed;
+  return event_particles(config);
+}
+
+}  // namespace coalescence
@@ -0,0 +1,139 @@
+#include <getopt.h>
+
+#include "coalescence/synthetic_smash.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+void usage(const int rc, const std::string &progname) {
+  std::printf("\nUsage: %s [option]\n\n", progname.c_str());
+  std::printf(
+      "  -h, --help              usage information\n\n"
+      "  -o, --outputfile        file in the extended SMASH binary format\n"
+      "                          (default: ./synthetic.bin)\n"
+      "  -n, --events            number of events (default: 10)\n"
+      "  -m, --multiplicity      hadrons per event (default: 1000)\n"
+      "  -N, --nucleon-fraction  fraction of protons and neutrons\n"
+      "                          (default: 0.2)\n"
+      "  -A, --antinucleon-fraction\n"
+      "                          fraction of antiprotons and antineutrons\n"
+      "                          (default: 0)\n"
+      "  -Y, --hyperon-fraction  fraction of lambdas and Sigma0\n"
+      "                          (default: 0.02), the rest are pions and\n"
+      "                          kaons\n"
+      "  -T, --temperature       of the Boltzmann spectra [GeV]\n"
+      "                          (default: 0.15)\n"
+      "  -y, --rapidity-width    half width of the rapidity plateau\n"
+      "                          (default: 1.5)\n"
+      "  -R, --radius            transverse Gaussian width [fm]\n"
+      "                          (default: 6)\n"
+      "  -t, --tau               freeze-out proper times are uniform in\n"
+      "                          [tau, tau + tau spread] [fm]\n"
+      "                          (default: 10)\n"
+      "  -d, --tau-spread        (default: 5)\n"
+      "  -b, --max-impact-parameter\n"
+      "                          [fm] (default: 10)\n"
+      "  -v, --format-version    6 or larger, 'f' blocks of versions\n"
+      "                          above 6 have an extra byte (default: 7)\n"
+      "  -s, --seed              random seed (default: 1)\n\n");
+  std::exit(rc);
+}
+}  // unnamed namespace
+
+/*
+ * Write synthetic events in the extended SMASH binary format, so that the
+ * afterburner can be tested and benchmarked without SMASH output.
+ */
+int main(int argc, char **argv) {
+  using namespace coalescence;
+  std::string output_file("synthetic.bin");
+  SyntheticEventConfig config;
+
+  constexpr option longopts[] = {
+      {"help", no_argument, 0, 'h'},
+      {"outputfile", required_argument, 0, 'o'},
+      {"events", required_argument, 0, 'n'},
+      {"multiplicity", required_argument, 0, 'm'},
+      {"nucleon-fraction", required_argument, 0, 'N'},
+      {"antinucleon-fraction", required_argument, 0, 'A'},
+      {"hyperon-fraction", required_argument, 0, 'Y'},
+      {"temperature", required_argument, 0, 'T'},
+      {"rapidity-width", required_argument, 0, 'y'},
+      {"radius", required_argument, 0, 'R'},
+      {"tau", required_argument, 0, 't'},
+      {"tau-spread", required_argument, 0, 'd'},
+      {"max-impact-parameter", required_argument, 0, 'b'},
+      {"format-version", required_argument, 0, 'v'},
+      {"seed", required_argument, 0, 's'},
+      {nullptr, 0, 0, 0}};
+
+  const std::string full_progname = std::string(argv[0]);
+  const std::string progname =
+      full_progname.substr(full_progname.find_last_of("\\/") + 1);
+  int opt = 0;
+  while ((opt = getopt_long(argc, argv, "A:b:d:hm:n:N:o:R:s:t:T:v:y:Y:",
+                            longopts, nullptr)) != -1) {
+    switch (opt) {
+      case 'h':
+        usage(EXIT_SUCCESS, progname);
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'n':
+        config.n_events = std::stoul(optarg);
+        break;
+      case 'm':
+        config.multiplicity = std::stoul(optarg);
+        break;
+      case 'N':
+        config.nucleon_fraction = std::stod(optarg);
+        break;
+      case 'A':
+        config.antinucleon_fraction = std::stod(optarg);
+        break;
+      case 'Y':
+        config.hyperon_fraction = std::stod(optarg);
+        break;
+      case 'T':
+        config.temperature = std::stod(optarg);
+        break;
+      case 'y':
+        config.rapidity_width = std::stod(optarg);
+        break;
+      case 'R':
+        config.radius = std::stod(optarg);
+        break;
+      case 't':
+        config.tau = std::stod(optarg);
+        break;
+      case 'd':
+        config.tau_spread = std::stod(optarg);
+        break;
+      case 'b':
+        config.max_impact_parameter = std::stod(optarg);
+        break;
+      case 'v':
+        config.format_version = static_cast<uint16_t>(std::stoul(optarg));
+        break;
+      case 's':
+        config.seed = std::stoull(optarg);
+        break;
+      default:
+        usage(EXIT_FAILURE, progname);
+    }
+  }
+  if (optind < argc) {
+    std::cout << argv[0] << ": invalid argument -- '" << argv[optind] << "'\n";
+    usage(EXIT_FAILURE, progname);
+  }
+
+  SyntheticSmashGenerator generator(config);
+  generator.write(output_file);
+  std::cout << "Wrote " << config.n_events << " events of "
+            << config.multiplicity << " hadrons to " << output_file
+            << std::endl;
+}
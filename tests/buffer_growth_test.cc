@@ -0,0 +1,66 @@
+#include "coalescence/coalescence.h"
+#include "coalescence/synthetic_smash.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "test_util.h"
+
+/**
+ * Buffers of the coalescence stop growing after the first batches: events
+ * like the ones before do not allocate, whichever thread takes them. The
+ * counts include the hadrons and nuclei of the events, the writer slots
+ * and the mixing slots, besides the arenas.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+std::string synthetic_file(size_t n_events, uint64_t seed) {
+  const std::string name = test::temporary_file();
+  SyntheticEventConfig config;
+  config.n_events = n_events;
+  config.multiplicity = 2000;
+  config.seed = seed;
+  SyntheticSmashGenerator(config).write(name);
+  return name;
+}
+
+}  // unnamed namespace
+
+int main() {
+  // Events to warm up with and other events of the same kind
+  const std::string warm_up = synthetic_file(200, 1),
+                    input = synthetic_file(100, 2);
+  for (int n_threads : {1, 4}) {
+#ifdef _OPENMP
+    omp_set_num_threads(n_threads);
+#endif
+    for (bool probabilistic : {false, true}) {
+      for (size_t mixing_window : {1, 3}) {
+        std::unique_ptr<Coalescence> coalescence =
+            test::make_coalescence(probabilistic, 1);
+        coalescence->set_mixing_window(mixing_window);
+        coalescence->make_nuclei(warm_up, 0);
+        const size_t n_events = coalescence->n_arena_events(),
+                     n_grown = coalescence->n_arena_allocations();
+        COALESCENCE_CHECK(n_events == 200);
+        // Growth is allowed while the first batch finds the sizes
+        COALESCENCE_CHECK(n_grown <= 2 * 4 * static_cast<size_t>(n_threads));
+        coalescence->make_nuclei(input, 1);
+        coalescence->flush_output();
+        COALESCENCE_CHECK(coalescence->n_arena_events() == n_events + 100);
+        COALESCENCE_CHECK(coalescence->n_arena_allocations() == n_grown);
+      }
+    }
+  }
+  std::remove(warm_up.c_str());
+  std::remove(input.c_str());
+  return test::result();
+}
@@ -0,0 +1,226 @@
+#include "coalescence/checkpoint.h"
+#include "coalescence/coalescence.h"
+#include "coalescence/histograms.h"
+#include "coalescence/nuclei_output.h"
+#include "coalescence/synthetic_smash.h"
+
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "test_util.h"
+
+/**
+ * Checkpoints and the histogram state read back as they were written, and
+ * a run continued from a checkpoint within a file gives the same nuclei
+ * and histograms as the run without interruption. The nuclei written
+ * after the checkpoint are cut off, and output of another format is not
+ * continued.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+constexpr uint64_t seed = 7;
+
+/// Content of the histogram state of \p histograms
+std::string state_of(const HistogramSet &histograms) {
+  const std::string file = test::temporary_file();
+  FILE *output = std::fopen(file.c_str(), "wb");
+  histograms.write_state(output);
+  std::fclose(output);
+  const std::string state = test::file_content(file);
+  std::remove(file.c_str());
+  return state;
+}
+
+HistogramSet filled_histograms() {
+  HistogramSet histograms;
+  histograms.add(Histogram::from_spec("d:y=-4,4,40:pt=0,3,30"));
+  histograms.add(Histogram::from_spec("p:y=-4,4,8:b=0,10,5"));
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for (double b : {1.0, 7.5, nan}) {
+    for (const Particle &nucleon : SyntheticSmashGenerator::nucleons(50, 3)) {
+      histograms.fill(nucleon, b);
+    }
+    histograms.add_event(b);
+  }
+  return histograms;
+}
+
+void test_checkpoint_file() {
+  const std::string file = test::temporary_file();
+  Checkpoint checkpoint;
+  checkpoint.seed = 0xFEDCBA9876543210ull;
+  checkpoint.event_number = 123456;
+  checkpoint.file_index = 3;
+  checkpoint.events_done = 17;
+  checkpoint.output_size = 1ull << 40;
+  checkpoint.histograms = filled_histograms();
+  checkpoint.write(file);
+  const Checkpoint read = Checkpoint::read(file);
+  COALESCENCE_CHECK(read.seed == checkpoint.seed);
+  COALESCENCE_CHECK(read.event_number == checkpoint.event_number);
+  COALESCENCE_CHECK(read.file_index == checkpoint.file_index);
+  COALESCENCE_CHECK(read.events_done == checkpoint.events_done);
+  COALESCENCE_CHECK(read.output_size == checkpoint.output_size);
+  COALESCENCE_CHECK(read.histograms.n_events() == 3.0);
+  COALESCENCE_CHECK(read.histograms.size() == 2);
+  COALESCENCE_CHECK(read.histograms[1].undefined() > 0.0);
+  COALESCENCE_CHECK(state_of(read.histograms) ==
+                    state_of(checkpoint.histograms));
+
+  // A checkpoint cut short is refused
+  const std::string content = test::file_content(file);
+  FILE *output = std::fopen(file.c_str(), "wb");
+  std::fwrite(content.data(), 1, content.size() - 8, output);
+  std::fclose(output);
+  bool thrown = false;
+  try {
+    Checkpoint::read(file);
+  } catch (std::runtime_error &) {
+    thrown = true;
+  }
+  COALESCENCE_CHECK(thrown);
+  std::remove(file.c_str());
+}
+
+/// Nuclei and histograms of a run, in one string
+std::string result_of(Coalescence &coalescence, const std::string &output) {
+  coalescence.flush_output();
+  const std::string histograms = output + ".h";
+  coalescence.write_histograms(histograms, OutputFormat::binary);
+  const std::string result = test::file_content(output) +
+                             test::file_content(histograms);
+  std::remove(histograms.c_str());
+  return result;
+}
+
+std::unique_ptr<Coalescence> make_run(bool probabilistic,
+                                      const std::string &output,
+                                      OutputFormat format,
+                                      uint64_t resume_output_size = 0) {
+  std::unique_ptr<Coalescence> coalescence = test::make_coalescence(
+      probabilistic, seed, output, format, false, resume_output_size);
+  coalescence->add_histogram(Histogram::from_spec("d:y=-4,4,40:b=0,10,5"));
+  return coalescence;
+}
+
+/**
+ * Interrupt a run after \p n_done events of \p input, whose first events
+ * are in \p head, and continue it from the checkpoint
+ */
+void test_resume(const std::string &input, const std::string &head,
+                 size_t n_done, bool probabilistic, OutputFormat format) {
+  const std::string output = test::temporary_file(),
+                    checkpoint_file = test::temporary_file();
+  std::string reference;
+  {
+    std::unique_ptr<Coalescence> coalescence =
+        make_run(probabilistic, output, format);
+    coalescence->make_nuclei(input, 0);
+    reference = result_of(*coalescence, output);
+  }
+
+  {
+    std::unique_ptr<Coalescence> coalescence =
+        make_run(probabilistic, output, format);
+    coalescence->set_checkpoint(checkpoint_file, 1e9);
+    coalescence->make_nuclei(head, 0);
+    coalescence->write_checkpoint(0, n_done);
+  }
+  // Nuclei written after the checkpoint, before the interruption
+  FILE *file = std::fopen(output.c_str(), "ab");
+  std::fputs("# event 9999 1\n", file);
+  std::fclose(file);
+
+  const Checkpoint checkpoint = Checkpoint::read(checkpoint_file);
+  COALESCENCE_CHECK(checkpoint.event_number == n_done);
+  COALESCENCE_CHECK(checkpoint.events_done == n_done);
+  COALESCENCE_CHECK(checkpoint.histograms.n_events() == n_done);
+  {
+    std::unique_ptr<Coalescence> coalescence =
+        make_run(probabilistic, output, format, checkpoint.output_size);
+    coalescence->restore(checkpoint);
+    coalescence->make_nuclei(input, checkpoint.file_index,
+                             checkpoint.events_done);
+    COALESCENCE_CHECK(result_of(*coalescence, output) == reference);
+  }
+
+  // The checkpoint does not fit to a run with other histograms or with
+  // another seed
+  for (bool other_seed : {false, true}) {
+    std::unique_ptr<Coalescence> other = test::make_coalescence(
+        probabilistic, other_seed ? seed + 1 : seed);
+    if (other_seed) {
+      other->add_histogram(Histogram::from_spec("d:y=-4,4,40:b=0,10,5"));
+    }
+    bool thrown = false;
+    try {
+      other->restore(checkpoint);
+    } catch (std::invalid_argument &) {
+      thrown = true;
+    }
+    COALESCENCE_CHECK(thrown);
+  }
+  std::remove(output.c_str());
+  std::remove(checkpoint_file.c_str());
+}
+
+/// Continuing output of another format or shorter than at the checkpoint
+void test_resume_errors() {
+  const std::string output = test::temporary_file();
+  {
+    std::unique_ptr<NucleiWriter> writer =
+        NucleiWriter::create(output, OutputFormat::binary, false);
+    writer->write_event(0, SyntheticSmashGenerator::nucleons(10, 1));
+    writer->flush();
+  }
+  const uint64_t size = test::file_content(output).size();
+  // As compressed output, which fails at the header or without zlib, and
+  // from beyond the end of the file
+  const bool compress[] = {true, false};
+  const uint64_t resume_offset[] = {size, size + 1};
+  for (int k = 0; k < 2; k++) {
+    bool thrown = false;
+    try {
+      NucleiWriter::create(output, OutputFormat::binary, compress[k],
+                           resume_offset[k]);
+    } catch (std::runtime_error &) {
+      thrown = true;
+    }
+    COALESCENCE_CHECK(thrown);
+  }
+  // Nothing was cut by the failed attempts
+  COALESCENCE_CHECK(test::file_content(output).size() == size);
+  std::remove(output.c_str());
+}
+
+}  // unnamed namespace
+
+int main() {
+  test_checkpoint_file();
+
+  // The first events of a file are the same in a file with fewer events
+  SyntheticEventConfig config;
+  config.multiplicity = 2000;
+  config.n_events = 40;
+  const std::string input = test::temporary_file(),
+                    head = test::temporary_file();
+  SyntheticSmashGenerator(config).write(input);
+  const size_t n_done = 13;
+  config.n_events = n_done;
+  SyntheticSmashGenerator(config).write(head);
+  for (bool probabilistic : {false, true}) {
+    for (OutputFormat format : {OutputFormat::text, OutputFormat::binary}) {
+      test_resume(input, head, n_done, probabilistic, format);
+    }
+  }
+  test_resume_errors();
+  std::remove(input.c_str());
+  std::remove(head.c_str());
+  return test::result();
+}
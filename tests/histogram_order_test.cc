@@ -0,0 +1,71 @@
+#include "coalescence/coalescence.h"
+#include "coalescence/synthetic_smash.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "test_util.h"
+
+/**
+ * Histograms and nuclei of a run do not depend on the number of threads,
+ * the weights are summed in the order of events.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+/// Nuclei and histograms of \p input with \p n_threads, in one string
+std::string run(const std::string &input, bool probabilistic,
+                size_t mixing_window, int n_threads) {
+#ifdef _OPENMP
+  omp_set_num_threads(n_threads);
+#else
+  (void)n_threads;
+#endif
+  const std::string output = test::temporary_file(),
+                    histograms = output + ".h";
+  {
+    std::unique_ptr<Coalescence> coalescence =
+        test::make_coalescence(probabilistic, 3, output);
+    coalescence->add_histogram(Histogram::from_spec("d:y=-4,4,40:pt=0,3,30"));
+    coalescence->add_histogram(Histogram::from_spec("p:y=-4,4,40:b=0,10,5"));
+    coalescence->set_mixing_window(mixing_window);
+    coalescence->make_nuclei(input, 0);
+    coalescence->flush_output();
+    coalescence->write_histograms(histograms, OutputFormat::binary);
+  }
+  const std::string result = test::file_content(output) +
+                             test::file_content(histograms);
+  std::remove(output.c_str());
+  std::remove(histograms.c_str());
+  return result;
+}
+
+}  // unnamed namespace
+
+int main() {
+  const std::string input = test::temporary_file();
+  SyntheticEventConfig config;
+  config.n_events = 40;
+  config.multiplicity = 2000;
+  SyntheticSmashGenerator(config).write(input);
+  for (bool probabilistic : {false, true}) {
+    for (size_t mixing_window : {1, 3}) {
+      const std::string reference = run(input, probabilistic,
+                                        mixing_window, 1);
+      COALESCENCE_CHECK(reference.size() > 0);
+      for (int n_threads : {3, 8}) {
+        COALESCENCE_CHECK(run(input, probabilistic, mixing_window,
+                              n_threads) == reference);
+      }
+    }
+  }
+  std::remove(input.c_str());
+  return test::result();
+}
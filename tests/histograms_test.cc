@@ -0,0 +1,116 @@
+#include "coalescence/histograms.h"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "test_util.h"
+
+/**
+ * Binning of values out of the range, infinities and NaN in histograms:
+ * infinities are under- or overflow, particles and events with a NaN are
+ * counted apart from all bins.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+constexpr double inf = std::numeric_limits<double>::infinity();
+const double nan = std::numeric_limits<double>::quiet_NaN();
+
+/// Deuteron with the rapidity \p y and the transverse momentum \p pt
+Particle deuteron(double y, double pt, double weight) {
+  Particle d = make_particle(FourVector(2.0, 0.0, 0.0, 0.0),
+                             FourVector(0.0, 0.0, 0.0, 0.0),
+                             ParticleType::d, 2212, 2112, weight);
+  d.kin.rapidity = y;
+  d.kin.pt = pt;
+  return d;
+}
+
+void test_axis() {
+  const HistogramAxis axis = {HistogramVariable::rapidity, -2.0, 2.0, 4};
+  COALESCENCE_CHECK(axis.bin(-2.0) == 0);
+  COALESCENCE_CHECK(axis.bin(1.5) == 3);
+  COALESCENCE_CHECK(axis.bin(-2.5) == -1);
+  COALESCENCE_CHECK(axis.bin(2.0) == 4);
+  COALESCENCE_CHECK(axis.bin(-1e300) == -1);
+  COALESCENCE_CHECK(axis.bin(1e300) == 4);
+  COALESCENCE_CHECK(axis.bin(-inf) == -1);
+  COALESCENCE_CHECK(axis.bin(inf) == 4);
+  COALESCENCE_CHECK(axis.bin(nan) == HistogramAxis::undefined);
+}
+
+void test_invalid_axes() {
+  for (double min : {-inf, nan, 0.0}) {
+    for (double max : {inf, nan, 0.0}) {
+      bool thrown = false;
+      try {
+        Histogram(ParticleType::d,
+                  {{HistogramVariable::rapidity, min, max, 4}});
+      } catch (std::invalid_argument &) {
+        thrown = true;
+      }
+      COALESCENCE_CHECK(thrown);
+    }
+  }
+}
+
+void test_fill() {
+  HistogramSet set;
+  set.add(Histogram::from_spec("d:y=-2,2,4:pt=0,2,2"));
+  set.add(Histogram::from_spec("d:b=0,10,2"));
+  set.fill(deuteron(0.5, 0.5, 1.0), 1.0);
+  set.fill(deuteron(-3.0, 5.0, 2.0), 1.0);    // under- and overflow
+  set.fill(deuteron(-inf, inf, 4.0), 20.0);   // the same bins
+  set.fill(deuteron(inf, 1.5, 8.0), -1.0);    // overflow and underflow
+  set.fill(deuteron(nan, 0.5, 16.0), 1.0);
+  set.fill(deuteron(0.5, nan, 32.0), 1.0);
+  set.fill(deuteron(0.5, 0.5, 64.0), nan);
+  set.add_event(1.0);
+  set.add_event(-inf);
+  set.add_event(nan);
+
+  const Histogram &h = set[0];
+  COALESCENCE_CHECK(h.value({2, 0, 0}) == 1.0 + 64.0);
+  COALESCENCE_CHECK(h.value({-1, 2, 0}) == 2.0 + 4.0);
+  COALESCENCE_CHECK(h.value({4, 1, 0}) == 8.0);
+  COALESCENCE_CHECK(h.undefined() == 16.0 + 32.0);
+  COALESCENCE_CHECK(h.n_events({0, 0, 0}) == 3.0);
+  COALESCENCE_CHECK(h.undefined_events() == 0.0);
+
+  const Histogram &b = set[1];
+  COALESCENCE_CHECK(b.value({0, 0, 0}) == 1.0 + 2.0 + 16.0 + 32.0);
+  COALESCENCE_CHECK(b.value({2, 0, 0}) == 4.0);
+  COALESCENCE_CHECK(b.value({-1, 0, 0}) == 8.0);
+  COALESCENCE_CHECK(b.undefined() == 64.0);
+  COALESCENCE_CHECK(b.n_events({0, 0, 0}) == 1.0);
+  COALESCENCE_CHECK(b.n_events({-1, 0, 0}) == 1.0);
+  COALESCENCE_CHECK(b.undefined_events() == 1.0);
+
+  // The separate counts are kept through the binary state and merging
+  FILE *state = std::tmpfile();
+  set.write_state(state);
+  std::rewind(state);
+  HistogramSet restored = HistogramSet::read_state(state);
+  std::fclose(state);
+  restored.merge(set);
+  COALESCENCE_CHECK(restored[0].undefined() == 2.0 * (16.0 + 32.0));
+  COALESCENCE_CHECK(restored[1].undefined() == 2.0 * 64.0);
+  COALESCENCE_CHECK(restored[1].undefined_events() == 2.0);
+  restored.clear();
+  COALESCENCE_CHECK(restored[0].undefined() == 0.0);
+  COALESCENCE_CHECK(restored[1].undefined_events() == 0.0);
+}
+
+}  // unnamed namespace
+
+int main() {
+  test_axis();
+  test_invalid_axes();
+  test_fill();
+  return test::result();
+}
@@ -0,0 +1,175 @@
+#include "coalescence/nuclei_output.h"
+#include "coalescence/synthetic_smash.h"
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+/**
+ * Binary nuclei output, plain and compressed in zlib chunks, is read back
+ * as it was written and converts to the same text as the text output. The
+ * same holds for output joined from parts with append(), as done for
+ * input files processed in parallel.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+struct NucleiEvent {
+  size_t event_number;
+  std::vector<Particle> nuclei;
+};
+
+/// Events with up to 120 nuclei, some without any, together over 1 MB
+std::vector<NucleiEvent> make_events(size_t n_events) {
+  const ParticleType types[] = {ParticleType::d, ParticleType::t,
+                                ParticleType::He3, ParticleType::ad};
+  std::vector<NucleiEvent> events(n_events);
+  for (size_t k = 0; k < n_events; k++) {
+    events[k].event_number = 10 * k + 3;
+    events[k].nuclei = SyntheticSmashGenerator::nucleons(k % 7 * 20, k);
+    for (size_t i = 0; i < events[k].nuclei.size(); i++) {
+      Particle &nucleus = events[k].nuclei[i];
+      nucleus.type = types[i % 4];
+      nucleus.pdg_mother1 = 2212;
+      nucleus.pdg_mother2 = -static_cast<int32_t>(i);
+      nucleus.weight = 1.0 / (1.0 + i);
+    }
+  }
+  return events;
+}
+
+/// Write \p events [begin, end) into a new \p file
+void write_part(const std::string &file, OutputFormat format, bool compress,
+                const std::vector<NucleiEvent> &events, size_t begin,
+                size_t end) {
+  std::unique_ptr<NucleiWriter> writer =
+      NucleiWriter::create(file, format, compress);
+  for (size_t k = begin; k < end; k++) {
+    writer->write_event(events[k].event_number, events[k].nuclei);
+  }
+  writer->flush();
+}
+
+/// Text of all nuclei in the binary \p file, as converted by nuclei_to_text
+std::string binary_to_text(const std::string &file) {
+  const std::string text_file = test::temporary_file();
+  FILE *output = std::fopen(text_file.c_str(), "w");
+  BinaryNucleiReader reader(file);
+  size_t event_number;
+  std::vector<Particle> nuclei;
+  while (reader.read_event(event_number, nuclei)) {
+    write_text_event(output, event_number, nuclei);
+  }
+  std::fclose(output);
+  const std::string text = test::file_content(text_file);
+  std::remove(text_file.c_str());
+  return text;
+}
+
+/// Whether the binary \p file holds exactly \p events
+bool same_events(const std::string &file,
+                 const std::vector<NucleiEvent> &events) {
+  BinaryNucleiReader reader(file);
+  size_t event_number;
+  std::vector<Particle> nuclei;
+  for (const NucleiEvent &event : events) {
+    if (!reader.read_event(event_number, nuclei) ||
+        event_number != event.event_number ||
+        nuclei.size() != event.nuclei.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < nuclei.size(); i++) {
+      const Particle &a = nuclei[i], &b = event.nuclei[i];
+      for (int k = 0; k < 4; k++) {
+        if (a.momentum[k] != b.momentum[k] || a.origin[k] != b.origin[k]) {
+          return false;
+        }
+      }
+      if (a.type != b.type || a.pdg_mother1 != b.pdg_mother1 ||
+          a.pdg_mother2 != b.pdg_mother2 || a.weight != b.weight) {
+        return false;
+      }
+    }
+  }
+  return !reader.read_event(event_number, nuclei);
+}
+
+}  // unnamed namespace
+
+int main() {
+  const std::vector<NucleiEvent> events = make_events(300);
+  const size_t n = events.size();
+  const std::string text = test::temporary_file();
+  write_part(text, OutputFormat::text, false, events, 0, n);
+  const std::string reference = test::file_content(text);
+  COALESCENCE_CHECK(reference.size() > 0);
+
+#ifdef COALESCENCE_HAVE_ZLIB
+  const bool compress_options[] = {false, true};
+#else
+  const bool compress_options[] = {false};
+#endif
+  const std::string whole = test::temporary_file(),
+                    joined = test::temporary_file(),
+                    part1 = test::temporary_file(),
+                    part2 = test::temporary_file();
+  for (bool compress : compress_options) {
+    write_part(whole, OutputFormat::binary, compress, events, 0, n);
+    COALESCENCE_CHECK(same_events(whole, events));
+    COALESCENCE_CHECK(binary_to_text(whole) == reference);
+
+    // The first part written by the joining writer itself, the others
+    // appended, one of them without any events
+    write_part(part1, OutputFormat::binary, compress, events, n / 3, n);
+    write_part(part2, OutputFormat::binary, compress, events, n, n);
+    {
+      std::unique_ptr<NucleiWriter> writer =
+          NucleiWriter::create(joined, OutputFormat::binary, compress);
+      for (size_t k = 0; k < n / 3; k++) {
+        writer->write_event(events[k].event_number, events[k].nuclei);
+      }
+      writer->append(part1);
+      writer->append(part2);
+      writer->flush();
+    }
+    COALESCENCE_CHECK(same_events(joined, events));
+    COALESCENCE_CHECK(binary_to_text(joined) == reference);
+
+#ifdef COALESCENCE_HAVE_ZLIB
+    // Parts of the other format are not appended
+    write_part(part1, OutputFormat::binary, !compress, events, 0, 1);
+    std::unique_ptr<NucleiWriter> writer =
+        NucleiWriter::create(joined, OutputFormat::binary, compress);
+    bool thrown = false;
+    try {
+      writer->append(part1);
+    } catch (std::runtime_error &) {
+      thrown = true;
+    }
+    COALESCENCE_CHECK(thrown);
+#endif
+  }
+
+  // Text output is joined the same way
+  write_part(part1, OutputFormat::text, false, events, 0, n / 2);
+  write_part(part2, OutputFormat::text, false, events, n / 2, n);
+  {
+    std::unique_ptr<NucleiWriter> writer =
+        NucleiWriter::create(joined, OutputFormat::text, false);
+    writer->append(part1);
+    writer->append(part2);
+    writer->flush();
+  }
+  COALESCENCE_CHECK(test::file_content(joined) == reference);
+
+  for (const std::string &file : {text, whole, joined, part1, part2}) {
+    std::remove(file.c_str());
+  }
+  return test::result();
+}
@@ -0,0 +1,97 @@
+#include "coalescence/nucleon_store.h"
+#include "coalescence/synthetic_smash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+/**
+ * The single precision pre-filter of NucleonStore selects every nucleon
+ * selected by the exact test in double precision, also for large momenta
+ * and rapidities, and selects only few more.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+// Largest share of the pairs tested, which the pre-filter may select in
+// addition to the exact test
+constexpr double max_extra_fraction = 1e-3;
+
+/// Nucleons of \p config boosted along the beam by the rapidity \p y
+std::vector<Particle> boosted_nucleons(SyntheticEventConfig config,
+                                       double y) {
+  config.nucleon_fraction = 1.0;
+  config.hyperon_fraction = 0.0;
+  std::vector<Particle> nucleons =
+      SyntheticSmashGenerator::event_particles(config);
+  const ThreeVector v(0.0, 0.0, -std::tanh(y));
+  for (Particle &nucleon : nucleons) {
+    nucleon = make_particle(nucleon.momentum.lorentz_boost(v),
+                            nucleon.origin.lorentz_boost(v), nucleon.type,
+                            nucleon.pdg_mother1, nucleon.pdg_mother2,
+                            nucleon.weight);
+  }
+  return nucleons;
+}
+
+void check_prefilter(const std::string &name,
+                     const SyntheticEventConfig &config, double y) {
+  const double max_dp2 = 0.44 * 0.44;
+  AlignedVector<uint8_t> scratch;
+  std::vector<uint32_t> exact, approximate, missed;
+  size_t n_tested = 0, n_exact = 0, n_missed = 0, n_extra = 0;
+  for (uint64_t seed = 1; seed <= 5; seed++) {
+    SyntheticEventConfig event_config = config;
+    event_config.seed = seed;
+    const std::vector<Particle> nucleons =
+        boosted_nucleons(event_config, y);
+    NucleonStore store;
+    for (const Particle &nucleon : nucleons) {
+      store.push_back(nucleon);
+    }
+    for (const Particle &nucleon : nucleons) {
+      exact.clear();
+      approximate.clear();
+      missed.clear();
+      store.select_close_momenta(nucleon.momentum, max_dp2, 0, store.size(),
+                                 exact, scratch);
+      store.prefilter_close_momenta(nucleon.momentum, max_dp2, 0,
+                                    store.size(), approximate, scratch);
+      std::set_difference(exact.begin(), exact.end(), approximate.begin(),
+                          approximate.end(), std::back_inserter(missed));
+      n_tested += store.size();
+      n_exact += exact.size();
+      n_missed += missed.size();
+      n_extra += approximate.size() + missed.size() - exact.size();
+    }
+  }
+  std::printf("%-28s %9zu pairs, %7zu selected, %zu missed, %zu extra\n",
+              name.c_str(), n_tested, n_exact, n_missed, n_extra);
+  COALESCENCE_CHECK(n_missed == 0);
+  COALESCENCE_CHECK(n_extra <= max_extra_fraction * n_tested);
+}
+
+}  // unnamed namespace
+
+int main() {
+  SyntheticEventConfig config;
+  config.multiplicity = 1000;
+  check_prefilter("default", config, 0.0);
+  for (double y : {2.0, 4.0, 5.0}) {
+    check_prefilter("boosted by y = " + std::to_string(y), config, y);
+  }
+  config.rapidity_width = 6.0;
+  check_prefilter("rapidities up to 6", config, 0.0);
+  config.rapidity_width = 1.5;
+  config.temperature = 3.0;
+  check_prefilter("temperature 3 GeV", config, 0.0);
+  check_prefilter("temperature 3 GeV, y = 4", config, 4.0);
+  return test::result();
+}
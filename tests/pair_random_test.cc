@@ -0,0 +1,76 @@
+#include "coalescence/pair_random.h"
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+
+#include "test_util.h"
+
+/**
+ * philox4x32 reproduces the known-answer vectors of Philox4x32-10 from
+ * Random123, and the number of a pair only depends on the seed, the file,
+ * the event, the channel and the two indices.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+struct KnownAnswer {
+  std::array<uint32_t, 4> counter;
+  std::array<uint32_t, 2> key;
+  std::array<uint32_t, 4> output;
+};
+
+// kat_vectors of Random123 for philox4x32 with 10 rounds
+const KnownAnswer known_answers[] = {
+    {{0x00000000, 0x00000000, 0x00000000, 0x00000000},
+     {0x00000000, 0x00000000},
+     {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+    {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+     {0xffffffff, 0xffffffff},
+     {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+    {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+     {0xa4093822, 0x299f31d0},
+     {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}},
+};
+
+}  // unnamed namespace
+
+int main() {
+  for (const KnownAnswer &answer : known_answers) {
+    COALESCENCE_CHECK(philox4x32(answer.counter, answer.key) ==
+                      answer.output);
+  }
+
+  // The same keys give the same number, from another generator as well
+  const uint64_t seed = 0x123456789ABCDEFull;
+  const size_t file = 3, event = 1234;
+  const uint32_t channel = 2, i = 17, j = 42;
+  const double u = PairRandom(seed, file, event).uniform(channel, i, j);
+  COALESCENCE_CHECK(u >= 0.0 && u < 1.0);
+  const PairRandom same(seed, file, event);
+  COALESCENCE_CHECK(same.uniform(channel, i, j) == u);
+  COALESCENCE_CHECK(same.uniform(channel, i, j) == u);
+  double batch[2];
+  const uint32_t partners[2] = {j, j};
+  same.uniform(channel, i, partners, 2, batch);
+  COALESCENCE_CHECK(batch[0] == u && batch[1] == u);
+
+  // Changing any one of them, including the upper halves of the seed and
+  // the highest file index bits kept, changes the number
+  COALESCENCE_CHECK(PairRandom(seed + 1, file, event)
+                        .uniform(channel, i, j) != u);
+  COALESCENCE_CHECK(PairRandom(seed ^ (1ull << 40), file, event)
+                        .uniform(channel, i, j) != u);
+  COALESCENCE_CHECK(PairRandom(seed, file + 1, event)
+                        .uniform(channel, i, j) != u);
+  COALESCENCE_CHECK(PairRandom(seed, file ^ 0x800000, event)
+                        .uniform(channel, i, j) != u);
+  COALESCENCE_CHECK(PairRandom(seed, file, event + 1)
+                        .uniform(channel, i, j) != u);
+  COALESCENCE_CHECK(same.uniform(channel + 1, i, j) != u);
+  COALESCENCE_CHECK(same.uniform(channel, i + 1, j) != u);
+  COALESCENCE_CHECK(same.uniform(channel, i, j + 1) != u);
+  return test::result();
+}
@@ -0,0 +1,123 @@
+#include "coalescence/coalescence.h"
+#include "coalescence/pair_search.h"
+#include "coalescence/synthetic_smash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "test_util.h"
+
+/**
+ * The partner searches on the momentum grid, in a rapidity window and over
+ * all particles find the same candidates and make the same nuclei. Their
+ * time for the sharp coalescence of the same events is printed.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+const PairSearch methods[] = {PairSearch::grid, PairSearch::rapidity,
+                              PairSearch::brute};
+
+bool same_nuclei(const std::vector<Particle> &a,
+                 const std::vector<Particle> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    for (int k = 0; k < 4; k++) {
+      if (a[i].momentum[k] != b[i].momentum[k] ||
+          a[i].origin[k] != b[i].origin[k]) {
+        return false;
+      }
+    }
+    if (a[i].type != b[i].type || a[i].pdg_mother1 != b[i].pdg_mother1 ||
+        a[i].pdg_mother2 != b[i].pdg_mother2 ||
+        a[i].weight != b[i].weight) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Candidates of every particle, the same for each method
+void test_candidates(const std::vector<Particle> &nucleons, double deltap) {
+  std::vector<std::vector<size_t>> reference(nucleons.size());
+  std::vector<size_t> candidates;
+  for (PairSearch method : methods) {
+    PairFinder finder;
+    finder.build(nucleons, deltap, method);
+    // Some particles are taken out, as by coalescence
+    for (size_t i = 0; i < nucleons.size(); i += 7) {
+      finder.invalidate(i);
+    }
+    size_t n_candidates = 0;
+    for (size_t i = 0; i < nucleons.size(); i++) {
+      finder.find_candidates(nucleons[i].momentum, deltap, candidates);
+      std::sort(candidates.begin(), candidates.end());
+      n_candidates += candidates.size();
+      if (method == PairSearch::grid) {
+        reference[i] = candidates;
+      } else {
+        COALESCENCE_CHECK(candidates == reference[i]);
+      }
+      for (size_t j : candidates) {
+        COALESCENCE_CHECK(j % 7 != 0);
+      }
+    }
+    std::printf("%-8s %zu candidates\n", pair_search_name(method),
+                n_candidates);
+  }
+}
+
+}  // unnamed namespace
+
+int main() {
+  std::unique_ptr<Coalescence> sharp = test::make_coalescence(false, 5);
+  Coalescence &coalescence = *sharp;
+
+  SyntheticEventConfig config;
+  config.multiplicity = 4000;
+  config.nucleon_fraction = 0.5;
+  config.antinucleon_fraction = 0.1;
+  config.hyperon_fraction = 0.1;
+  std::vector<std::vector<Particle>> events;
+  for (uint64_t seed = 1; seed <= 10; seed++) {
+    config.seed = seed;
+    events.push_back(SyntheticSmashGenerator::event_particles(config));
+  }
+  test_candidates(events[0], test::deltap);
+
+  // Sharp coalescence in all channels, timed
+  typedef std::chrono::steady_clock clock;
+  std::vector<std::vector<Particle>> reference(events.size());
+  std::vector<Particle> nuclei;
+  Coalescence::EventArena arena;
+  for (PairSearch method : methods) {
+    coalescence.set_pair_search(method);
+    size_t n_nuclei = 0;
+    double seconds = 0.0;
+    for (size_t i = 0; i < events.size(); i++) {
+      const clock::time_point start = clock::now();
+      coalescence.coalesce(events[i], nuclei,
+                           coalescence.event_random(0, i), arena);
+      seconds += std::chrono::duration<double>(clock::now() - start).count();
+      n_nuclei += nuclei.size();
+      if (method == PairSearch::grid) {
+        reference[i] = nuclei;
+      } else {
+        COALESCENCE_CHECK(same_nuclei(nuclei, reference[i]));
+      }
+    }
+    COALESCENCE_CHECK(n_nuclei > 0);
+    std::printf("%-8s %zu nuclei in %zu events, %8.2f ms per event\n",
+                pair_search_name(method), n_nuclei, events.size(),
+                1e3 * seconds / events.size());
+  }
+  return test::result();
+}
@@ -0,0 +1,94 @@
+#include "coalescence/coalescence.h"
+#include "coalescence/nucleon_store.h"
+#include "coalescence/pair_weight_kernel.h"
+#include "coalescence/synthetic_smash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "test_util.h"
+
+/**
+ * The batched pair weights of every instruction set supported here agree
+ * with the scalar Coalescence::get_pair_weight, also for batches, which
+ * do not fill the last vector.
+ */
+
+using namespace coalescence;
+
+namespace {
+
+// Largest relative difference to get_pair_weight
+constexpr double tolerance = 1e-12;
+// get_pair_weight returns 0 below this weight, the kernels do not cut
+constexpr double weight_cutoff = 1e-6;
+
+}  // unnamed namespace
+
+int main() {
+  std::unique_ptr<Coalescence> coalescence = test::make_coalescence(true, 1);
+  const Coalescence &probabilistic = *coalescence;
+  constexpr double d2 = 3.2 * 3.2;
+
+  for (uint64_t seed = 1; seed <= 3; seed++) {
+    const std::vector<Particle> nucleons =
+        SyntheticSmashGenerator::nucleons(300, seed);
+    NucleonStore store;
+    for (const Particle &nucleon : nucleons) {
+      store.push_back(nucleon);
+    }
+    // Partners in a random order, taken in prefixes of every length up
+    // to a few vectors and as a whole
+    std::vector<uint32_t> positions(nucleons.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::mt19937 rng(seed);
+    std::shuffle(positions.begin(), positions.end(), rng);
+    std::vector<size_t> lengths(20);
+    std::iota(lengths.begin(), lengths.end(), 1);
+    lengths.push_back(positions.size());
+    std::vector<double> weights(positions.size());
+
+    for (SimdLevel level : {SimdLevel::scalar, SimdLevel::avx2,
+                            SimdLevel::avx512}) {
+      if (level > best_simd_level()) {
+        std::printf("%s is not supported, skipped\n",
+                    simd_level_name(level));
+        continue;
+      }
+      size_t n_pairs = 0;
+      double max_difference = 0.0;
+      for (size_t i = 0; i < nucleons.size(); i++) {
+        for (size_t n : lengths) {
+          pair_weights(level, nucleons[i].momentum, nucleons[i].origin,
+                       store, positions.data(), n, d2, test::hbarc,
+                       weights.data());
+          for (size_t k = 0; k < n; k++) {
+            const size_t j = positions[k];
+            if (j == i) {
+              continue;
+            }
+            const double w =
+                probabilistic.get_pair_weight(nucleons[i], nucleons[j]);
+            n_pairs++;
+            if (w > 0.0) {
+              const double difference = std::abs(weights[k] - w) / w;
+              max_difference = std::max(max_difference, difference);
+              COALESCENCE_CHECK(difference <= tolerance);
+            } else {
+              COALESCENCE_CHECK(weights[k] >= 0.0 &&
+                                weights[k] < weight_cutoff * (1.0 + 1e-6));
+            }
+          }
+        }
+      }
+      std::printf("%-8s %zu pairs, largest relative difference %.3e\n",
+                  simd_level_name(level), n_pairs, max_difference);
+    }
+  }
+  return test::result();
+}
@@ -0,0 +1,86 @@
+#ifndef COALESCENCE_TESTS_TEST_UTIL_H
+#define COALESCENCE_TESTS_TEST_UTIL_H
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "coalescence/coalescence.h"
+
+/**
+ * Minimal support for the tests, which are plain programs run by ctest.
+ * A failed check is reported with its location, and the test returns the
+ * number of failures as its exit status.
+ */
+
+namespace coalescence {
+namespace test {
+
+/// Number of failed checks so far
+inline int &n_failures() {
+  static int n = 0;
+  return n;
+}
+
+/// Exit status of the test
+inline int result() {
+  if (n_failures() > 0) {
+    std::printf("%d checks failed\n", n_failures());
+  }
+  return n_failures() > 0 ? 1 : 0;
+}
+
+/// Name of a new empty file, which the test removes when done
+inline std::string temporary_file() {
+  char name[] = "/tmp/coalescence_test_XXXXXX";
+  const int fd = mkstemp(name);
+  if (fd < 0) {
+    throw std::runtime_error("Can't create a temporary file");
+  }
+  close(fd);
+  return name;
+}
+
+/// Whole content of \p file
+inline std::string file_content(const std::string &file) {
+  std::ifstream input(file, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(input),
+                     std::istreambuf_iterator<char>());
+}
+
+// Cuts of the tests, the distance from the momentum as in the main program
+constexpr double hbarc = 0.197327053;                 // GeV fm
+constexpr double deltap = 0.44;                       // GeV
+constexpr double deltar = 2.0 * M_PI * hbarc / deltap;  // fm
+
+/// Coalescence with the cuts above, writing the nuclei to \p output_file
+inline std::unique_ptr<Coalescence> make_coalescence(
+    bool probabilistic, uint64_t seed,
+    const std::string &output_file = "/dev/null",
+    OutputFormat format = OutputFormat::binary, bool compress = false,
+    uint64_t resume_output_size = 0) {
+  return std::unique_ptr<Coalescence>(new Coalescence(
+      output_file, deltap, deltar, probabilistic, seed, format, compress,
+      resume_output_size));
+}
+
+}  // namespace test
+}  // namespace coalescence
+
+#define COALESCENCE_CHECK(condition)                                  \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__,    \
+                  #condition);                                        \
+      ::coalescence::test::n_failures()++;                            \
+    }                                                                 \
+  } while (false)
+
+#endif  // COALESCENCE_TESTS_TEST_UTIL_H